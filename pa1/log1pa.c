@@ -40,7 +40,12 @@ void log_destroy(){
 void log_pipes(PipesCommunication* comm){
 	size_t i;
 	
-	fprintf(pipes_log_f, "Process %d pipes:\n", comm->current_id);
+	if (comm->pipes == NULL){
+		fprintf(pipes_log_f, "Process %d uses %s transport\n", comm->current_id, comm->transport->name);
+		return;
+	}
+	
+	fprintf(pipes_log_f, "Process %d %s:\n", comm->current_id, comm->seqpacket ? "sockets" : "pipes");
 	
 	for (i = 0; i < comm->total_ids; i++){
 		if (i == comm->current_id){
@@ -52,3 +57,7 @@ void log_pipes(PipesCommunication* comm){
 	}
 	fprintf(pipes_log_f, "\n");
 }
+
+void log_startup_stats(PipesCommunication* comm){
+	fprintf(stderr, "Process %d received all STARTED %ld us after startup\n", comm->current_id, comm->startup_us);
+}
@@ -11,5 +11,6 @@ void log_done(local_id id);
 void log_received_all_done(local_id id);
 void log_destroy();
 void log_pipes(PipesCommunication* comm);
+void log_startup_stats(PipesCommunication* comm);
 
 #endif
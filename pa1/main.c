@@ -5,15 +5,17 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/wait.h>
+#include <getopt.h>
 
 #include "pa1.h"
 #include "ipc.h"
 #include "log1pa.h"
 #include "communication.h"
+#include "spawn.h"
 
 #define BUFFER_SIZE 512
 
-int get_proc_count(char** argv);
+int get_agrs(int argc, char** argv, int* processes, const Transport** transport, int* fork_tree, int* stats);
 int send_msg(PipesCommunication* comm, MessageType type);
 int recieve_msgs(PipesCommunication* comm, MessageType type);
 
@@ -21,29 +23,21 @@ int recieve_msgs(PipesCommunication* comm, MessageType type);
  * @return -1 on invalid arguments, -2 on fork error, 0 on success
  */
 int main(int argc, char** argv){
-	size_t i;
 	int proc_count;
+	int fork_tree;
+	int stats;
+	int spawned;
 	local_id current_proc_id;
-	pid_t fork_id;
 	pid_t* children;
-	int* pipes;
+	size_t child_count;
+	const Transport* transport;
+	void* channels;
 	PipesCommunication* comm;
 	
 	/* Resolving program arguments */
-	switch(argc){
-		case 1:
-			proc_count = 1; /* TODO: set new default value */
-			break;
-		case 3:
-			proc_count = get_proc_count(argv);
-			if (proc_count <= 0 || proc_count > MAX_PROCESS_ID + 1){
-				fprintf(stderr, "Usage: %s -p (1-16)\n", argv[0]);
-				return -1;
-			}
-			break;
-		default:
-			fprintf(stderr, "Usage: %s -p (1-16)\n", argv[0]);
-			return -1;
+	if (get_agrs(argc, argv, &proc_count, &transport, &fork_tree, &stats)){
+		fprintf(stderr, "Usage: %s -p (1-16) [--transport=pipe|shm|uds|tcp|inbox] [--fork-tree] [--stats]\n", argv[0]);
+		return -1;
 	}
 	
 	/* Initialize log files */
@@ -52,32 +46,23 @@ int main(int argc, char** argv){
 	/* Allocate memory for children */
 	children = malloc(sizeof(pid_t) * proc_count);
 	
-	/* Open pipes for all processes */
-	pipes = pipes_init(proc_count + 1);
-	
-	/* Create children processes */
-	for (i = 0; i < proc_count; i++){
-		fork_id = fork();
-		if (fork_id < 0){
-			return -2;
-		}
-		else if (fork_id == 0){
-			free(children);
-			break;
-		}
-		children[i] = fork_id;
+	/* Open pipes, sockets or rings for all processes */
+	startup_begin();
+	channels = transport->open(proc_count + 1);
+	if (channels == NULL){
+		fprintf(stderr, "Can not open %s channels for %d processes\n", transport->name, proc_count + 1);
+		return -2;
 	}
 	
-	/* Set current process id */
-	if (fork_id == 0){
-		current_proc_id = i + 1;
-	}
-	else{
-		current_proc_id = PARENT_ID;
+	/* Create children processes, serially or as a tree */
+	spawned = spawn_processes(proc_count + 1, fork_tree, children, &child_count);
+	if (spawned < 0){
+		return -2;
 	}
+	current_proc_id = spawned;
 	
-	/* Set pipe fds to process params */
-	comm = communication_init(pipes, proc_count + 1, current_proc_id);
+	/* Keep channels of the current process */
+	comm = communication_init(transport, channels, proc_count + 1, current_proc_id);
 	log_pipes(comm);
 	
 	/* Send & recieve started message */
@@ -92,29 +77,63 @@ int main(int argc, char** argv){
 	}
 	recieve_msgs(comm, DONE);
 	
-	/* Waiting for all children if parent process */
-	if (current_proc_id == PARENT_ID){
-		for (i = 0; i < proc_count; i++){
-			waitpid(children[i], NULL, 0);
-		}
+	if (stats){
+		log_startup_stats(comm);
 	}
 	
 	log_destroy();
 	communication_destroy(comm);
+	
+	/* Waiting for own children once own messages are out, they wait for theirs */
+	reap_children(children, child_count);
+	free(children);
 	return 0;
 }
 
-/** Get process count from command line arguments.
+/** Get process count and transport from command line arguments.
+ *
+ * Without arguments one child process talks through pipes.
  *
+ * @param argc		Count of command line arguments.
  * @param argv		Double char array containing command line arguments.
+ * @param processes	Child process count, set here
+ * @param transport	Transport named by --transport, set here
+ * @param fork_tree	1 if --fork-tree asks to fork children as a tree, set here
+ * @param stats		1 if --stats asks for the startup time, set here
  *
- * @return -1 on error, any other values on success.
+ * @return -1 on error, 0 on success.
  */
-int get_proc_count(char** argv){
-	if (!strcmp(argv[1], "-p")){
-		return atoi(argv[2]);
+int get_agrs(int argc, char** argv, int* processes, const Transport** transport, int* fork_tree, int* stats){
+	int res;
+	const struct option long_options[] = {
+		{"transport", required_argument, NULL, 't'},
+		{"fork-tree", no_argument, fork_tree, 1},
+		{"stats", no_argument, stats, 1},
+		{NULL, 0, NULL, 0}
+	};
+	
+	*processes = 1; /* TODO: set new default value */
+	*transport = &pipe_transport;
+	*fork_tree = 0;
+	*stats = 0;
+	
+	while ((res = getopt_long(argc, argv, "p:", long_options, NULL)) != -1){
+		if (res == 'p'){
+			*processes = atoi(optarg);
+		}
+		else if (res == 't'){
+			if ((*transport = transport_find(optarg)) == NULL){
+				return -1;
+			}
+		}
+		else if (res == '?'){
+			return -1;
+		}
 	}
-	return -1;
+	if (optind != argc || *processes <= 0 || *processes > MAX_PROCESS_ID + 1){
+		return -1;
+	}
+	return 0;
 }
 
 /** Send message to all other processes
@@ -168,13 +187,21 @@ int send_msg(PipesCommunication* comm, MessageType type){
  */
 int recieve_msgs(PipesCommunication* comm, MessageType type){
 	Message msg;
+	local_id i;
 	
-	if (receive_any(comm, &msg)){
-		return -1;
+	/* One message from every child process */
+	for (i = 1; i < comm->total_ids; i++){
+		if (i == comm->current_id){
+			continue;
+		}
+		if (receive_type_blocking(comm, i, type, &msg)){
+			return -1;
+		}
 	}
 	
 	switch (type){
         case STARTED:
+            comm->startup_us = startup_elapsed_us();
             log_received_all_started(comm->current_id);
             break;
         case DONE:
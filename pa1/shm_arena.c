@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include "shm_arena.h"
+
+#include <sys/mman.h>
+
+#define ARENA_ROUND(len) (((len) + SHM_ARENA_ALIGN - 1) / SHM_ARENA_ALIGN * SHM_ARENA_ALIGN)
+#define ARENA_HEADER ARENA_ROUND(sizeof(ShmArena))
+
+static ShmBlock* arena_first(ShmArena* arena){
+	return (ShmBlock*) ((char*) arena + ARENA_HEADER);
+}
+
+static ShmBlock* arena_end(ShmArena* arena){
+	return (ShmBlock*) ((char*) arena_first(arena) + arena->size);
+}
+
+static ShmBlock* block_next(ShmBlock* block){
+	return (ShmBlock*) ((char*) block + block->size);
+}
+
+/** Map an arena of size bytes in memory shared with future children
+ *
+ * Must be called before fork(), or shared by threads of one process.
+ *
+ * @return arena with one free block, NULL on mmap error
+ */
+ShmArena* shm_arena_init(size_t size){
+	pthread_mutexattr_t attr;
+	ShmArena* arena;
+
+	size = ARENA_ROUND(size);
+	if (size < sizeof(ShmBlock) || size > UINT32_MAX){
+		return NULL;
+	}
+	arena = mmap(NULL, ARENA_HEADER + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED){
+		return NULL;
+	}
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&arena->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	arena->size = size;
+	arena_first(arena)->size = size;
+	arena_first(arena)->refs = 0;
+	return arena;
+}
+
+void shm_arena_destroy(ShmArena* arena){
+	munmap(arena, ARENA_HEADER + arena->size);
+}
+
+/** Take the first free block with room for len bytes, merging free neighbours on the way
+ *
+ * @return payload of the block with one reference held by the caller, NULL if no block is large enough
+ */
+void* shm_arena_alloc(ShmArena* arena, size_t len){
+	size_t need = ARENA_ROUND(sizeof(ShmBlock) + len);
+	ShmBlock* block;
+	ShmBlock* end = arena_end(arena);
+	void* data = NULL;
+
+	pthread_mutex_lock(&arena->lock);
+	for (block = arena_first(arena); block < end; block = block_next(block)){
+		if (__atomic_load_n(&block->refs, __ATOMIC_ACQUIRE)){
+			continue;
+		}
+		while (block_next(block) < end && !__atomic_load_n(&block_next(block)->refs, __ATOMIC_ACQUIRE)){
+			block->size += block_next(block)->size;
+		}
+		if (block->size >= need){
+			/* Split off the rest when it can hold a block of its own */
+			if (block->size - need >= sizeof(ShmBlock) + SHM_ARENA_ALIGN){
+				ShmBlock* rest = (ShmBlock*) ((char*) block + need);
+
+				rest->size = block->size - need;
+				rest->refs = 0;
+				block->size = need;
+			}
+			block->refs = 1;
+			data = block + 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&arena->lock);
+	return data;
+}
+
+/* One more holder of the block, every holder releases it once */
+void shm_arena_retain(ShmArena* arena, void* data){
+	__atomic_add_fetch(&((ShmBlock*) data - 1)->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* Drop one reference, the block is free again after the last one */
+void shm_arena_release(ShmArena* arena, void* data){
+	__atomic_sub_fetch(&((ShmBlock*) data - 1)->refs, 1, __ATOMIC_RELEASE);
+}
+
+int shm_arena_contains(ShmArena* arena, const void* data){
+	return arena != NULL && (const char*) data > (const char*) arena_first(arena) && (const char*) data < (const char*) arena_end(arena);
+}
+
+/* Position of the payload in the arena, the same in every process that maps it */
+uint32_t shm_arena_offset(ShmArena* arena, const void* data){
+	return (const char*) data - (const char*) arena;
+}
+
+void* shm_arena_data(ShmArena* arena, uint32_t offset){
+	return (char*) arena + offset;
+}
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include "shm_ring.h"
+
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static size_t shm_region_size(size_t proc_count){
+	return sizeof(ShmRing) * proc_count * proc_count + sizeof(ShmBroadcast) * proc_count
+		+ sizeof(ShmDoorbell) * proc_count;
+}
+
+/** Map rings for every (src, dst) pair in memory shared with future children
+ *
+ * Must be called before fork(). Broadcast rings of all processes follow
+ * the rings, doorbells follow broadcast rings.
+ *
+ * @param proc_count    Process count including parent process.
+ *
+ * @return pointer to proc_count * proc_count rings, NULL on mmap error
+ */
+ShmRing* shm_rings_init(size_t proc_count){
+	ShmRing* rings;
+
+	if (proc_count > SHM_MAX_PROCS){
+		return NULL;
+	}
+	rings = mmap(NULL, shm_region_size(proc_count),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (rings == MAP_FAILED){
+		return NULL;
+	}
+	return rings;
+}
+
+void shm_rings_destroy(ShmRing* rings, size_t proc_count){
+	munmap(rings, shm_region_size(proc_count));
+}
+
+/** Get the ring carrying frames from process from to process to */
+ShmRing* shm_ring_get(ShmRing* rings, size_t proc_count, size_t from, size_t to){
+	return rings + from * proc_count + to;
+}
+
+static void ring_copy_in(char* ring, uint64_t pos, const void* src, size_t len){
+	size_t offset = pos & (SHM_RING_SIZE - 1);
+	size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+
+	memcpy(ring + offset, src, first);
+	memcpy(ring, (const char*) src + first, len - first);
+}
+
+static void ring_copy_out(const char* ring, uint64_t pos, void* dst, size_t len){
+	size_t offset = pos & (SHM_RING_SIZE - 1);
+	size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+
+	memcpy(dst, ring + offset, first);
+	memcpy((char*) dst + first, ring, len - first);
+}
+
+/* Write one frame at tail, the caller checked for room and publishes it */
+static void frame_write(char* ring, uint64_t tail, uint32_t seq, const void* data, uint32_t len){
+	ShmFrameHeader header;
+
+	header.len = len;
+	header.seq = seq;
+	ring_copy_in(ring, tail, &header, sizeof(ShmFrameHeader));
+	ring_copy_in(ring, tail + sizeof(ShmFrameHeader), data, len);
+}
+
+/** Append one frame, all or nothing
+ *
+ * @return -1 if the ring has no room for the frame, 0 on success
+ */
+int shm_ring_push(ShmRing* ring, uint32_t seq, const void* data, uint32_t len){
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (SHM_RING_SIZE - (tail - head) < sizeof(ShmFrameHeader) + len){
+		return -1;
+	}
+	frame_write(ring->data, tail, seq, data, len);
+	__atomic_store_n(&ring->tail, tail + sizeof(ShmFrameHeader) + len, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Append frames numbered from seq on while the ring has room for them
+ *
+ * The tail moves once after the last of them, so the consumer sees all
+ * of them together and one doorbell ring covers the whole run.
+ *
+ * @return count of leading frames appended
+ */
+size_t shm_ring_pushv(ShmRing* ring, uint32_t seq, const struct iovec* frames, size_t n){
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t i;
+
+	for (i = 0; i < n && SHM_RING_SIZE - (tail - head) >= sizeof(ShmFrameHeader) + frames[i].iov_len; i++){
+		frame_write(ring->data, tail, seq + i, frames[i].iov_base, frames[i].iov_len);
+		tail += sizeof(ShmFrameHeader) + frames[i].iov_len;
+	}
+	if (i){
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	return i;
+}
+
+/** Look at the oldest frame without taking it
+ *
+ * @return -1 if the ring is empty, frame length otherwise
+ */
+int shm_ring_peek(ShmRing* ring, uint32_t* seq){
+	ShmFrameHeader header;
+
+	if (shm_ring_empty(ring)){
+		return -1;
+	}
+	ring_copy_out(ring->data, ring->head, &header, sizeof(ShmFrameHeader));
+	*seq = header.seq;
+	return header.len;
+}
+
+/** Take the oldest frame
+ *
+ * @return -1 if the ring is empty, -2 if the frame exceeds capacity, frame length otherwise
+ */
+int shm_ring_pop(ShmRing* ring, void* data, uint32_t capacity){
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	ShmFrameHeader header;
+
+	if (head == tail){
+		return -1;
+	}
+	ring_copy_out(ring->data, head, &header, sizeof(ShmFrameHeader));
+	if (header.len > capacity){
+		return -2;
+	}
+	ring_copy_out(ring->data, head + sizeof(ShmFrameHeader), data, header.len);
+	__atomic_store_n(&ring->head, head + sizeof(ShmFrameHeader) + header.len, __ATOMIC_RELEASE);
+	return header.len;
+}
+
+int shm_ring_empty(ShmRing* ring){
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head;
+}
+
+size_t shm_ring_free(ShmRing* ring){
+	return SHM_RING_SIZE - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+}
+
+/** Get the broadcast ring of process from */
+ShmBroadcast* shm_broadcast_get(ShmRing* rings, size_t proc_count, size_t from){
+	return (ShmBroadcast*) (rings + proc_count * proc_count) + from;
+}
+
+/** Room left behind the slowest reader of the broadcast ring */
+size_t shm_broadcast_free(ShmBroadcast* ring, size_t proc_count, size_t from){
+	uint64_t tail = ring->tail;
+	uint64_t used = 0;
+	size_t i;
+
+	for (i = 0; i < proc_count; i++){
+		uint64_t head, lag;
+
+		if (i == from || (head = __atomic_load_n(&ring->cursors[i].head, __ATOMIC_ACQUIRE)) == SHM_READER_GONE){
+			continue;
+		}
+		lag = tail - head;
+		if (lag > used){
+			used = lag;
+		}
+	}
+	return SHM_RING_SIZE - used;
+}
+
+/* The reader takes no more frames, the ring stops keeping them for it */
+void shm_broadcast_leave(ShmBroadcast* ring, size_t reader){
+	__atomic_store_n(&ring->cursors[reader].head, SHM_READER_GONE, __ATOMIC_RELEASE);
+}
+
+/** Append one frame for every other process, all or nothing
+ *
+ * @param ring          Broadcast ring of process from
+ * @param proc_count    Process count including parent process.
+ * @param from          Producing process, it has no cursor to wait for.
+ *
+ * @return -1 if some reader has not freed room for the frame yet, 0 on success
+ */
+int shm_broadcast_push(ShmBroadcast* ring, size_t proc_count, size_t from, uint32_t seq, const void* data, uint32_t len){
+	uint64_t tail = ring->tail;
+
+	if (shm_broadcast_free(ring, proc_count, from) < sizeof(ShmFrameHeader) + len){
+		return -1;
+	}
+	frame_write(ring->data, tail, seq, data, len);
+	__atomic_store_n(&ring->tail, tail + sizeof(ShmFrameHeader) + len, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Look at the oldest frame not yet taken by reader
+ *
+ * @return -1 if the reader has taken every frame, frame length otherwise
+ */
+int shm_broadcast_peek(ShmBroadcast* ring, size_t reader, uint32_t* seq){
+	ShmFrameHeader header;
+
+	if (shm_broadcast_empty(ring, reader)){
+		return -1;
+	}
+	ring_copy_out(ring->data, ring->cursors[reader].head, &header, sizeof(ShmFrameHeader));
+	*seq = header.seq;
+	return header.len;
+}
+
+/** Take the oldest frame not yet taken by reader
+ *
+ * @return -1 if the reader has taken every frame, -2 if the frame exceeds capacity, frame length otherwise
+ */
+int shm_broadcast_pop(ShmBroadcast* ring, size_t reader, void* data, uint32_t capacity){
+	uint64_t head = ring->cursors[reader].head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	ShmFrameHeader header;
+
+	if (head == tail){
+		return -1;
+	}
+	ring_copy_out(ring->data, head, &header, sizeof(ShmFrameHeader));
+	if (header.len > capacity){
+		return -2;
+	}
+	ring_copy_out(ring->data, head + sizeof(ShmFrameHeader), data, header.len);
+	__atomic_store_n(&ring->cursors[reader].head, head + sizeof(ShmFrameHeader) + header.len, __ATOMIC_RELEASE);
+	return header.len;
+}
+
+int shm_broadcast_empty(ShmBroadcast* ring, size_t reader){
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->cursors[reader].head;
+}
+
+ShmDoorbell* shm_doorbell_get(ShmRing* rings, size_t proc_count, size_t id){
+	return (ShmDoorbell*) (shm_broadcast_get(rings, proc_count, proc_count)) + id;
+}
+
+/** Announce that the owner is about to sleep on its doorbell
+ *
+ * The owner must re-check its wake condition after this call and either
+ * cancel or wait with the returned sequence number.
+ *
+ * @return current sequence number
+ */
+uint32_t shm_doorbell_prepare(ShmDoorbell* bell){
+	uint32_t seq = __atomic_load_n(&bell->seq, __ATOMIC_ACQUIRE);
+
+	__atomic_store_n(&bell->sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return seq;
+}
+
+/** Sleep until the doorbell rings after shm_doorbell_prepare() returned seq
+ *
+ * @param timeout_us	Longest sleep, -1 for no limit
+ */
+void shm_doorbell_wait(ShmDoorbell* bell, uint32_t seq, long timeout_us){
+	struct timespec timeout;
+
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_nsec = timeout_us % 1000000 * 1000;
+	syscall(SYS_futex, &bell->seq, FUTEX_WAIT, seq, timeout_us < 0 ? NULL : &timeout, NULL, 0);
+	__atomic_store_n(&bell->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+void shm_doorbell_cancel(ShmDoorbell* bell){
+	__atomic_store_n(&bell->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/** Wake the owner of the doorbell if it sleeps, cheap otherwise */
+void shm_doorbell_ring(ShmDoorbell* bell){
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&bell->sleeping, __ATOMIC_RELAXED)){
+		__atomic_add_fetch(&bell->seq, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &bell->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/* The owner closes its end: every frame it pushed is published, none follows */
+void shm_doorbell_close(ShmDoorbell* bell){
+	__atomic_store_n(&bell->closed, 1, __ATOMIC_RELEASE);
+}
+
+int shm_doorbell_closed(ShmDoorbell* bell){
+	return __atomic_load_n(&bell->closed, __ATOMIC_ACQUIRE);
+}
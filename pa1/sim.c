@@ -0,0 +1,180 @@
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Parse a latency distribution of the command line
+ *
+ * "const:D" delays every message by D ticks, "uniform:MIN:MAX" by a
+ * number of ticks drawn uniformly from [MIN, MAX].
+ *
+ * @return -1 if spec is malformed, 0 on success
+ */
+int sim_latency_parse(const char* spec, SimLatency* latency){
+	int end = -1;
+
+	if (sscanf(spec, "const:%ld%n", &latency->min, &end) == 1 && spec[end] == '\0'){
+		latency->max = latency->min;
+	}
+	else if (sscanf(spec, "uniform:%ld:%ld%n", &latency->min, &latency->max, &end) != 2 || spec[end] != '\0'){
+		return -1;
+	}
+	return latency->min < 0 || latency->max < latency->min ? -1 : 0;
+}
+
+/** Create the links between all participants of a simulated run
+ *
+ * @param proc_count    Process count including parent process.
+ * @param latency       Distribution every link draws its delays from
+ * @param seed          Seed of the generator, equal seeds give equal runs
+ *
+ * @return network at virtual time 0, NULL if memory is exhausted
+ */
+SimNet* sim_net_init(size_t proc_count, SimLatency latency, uint64_t seed){
+	SimNet* net = malloc(sizeof(SimNet));
+
+	if (net == NULL){
+		return NULL;
+	}
+	net->now = 0;
+	/* xorshift never leaves the zero state */
+	net->rng = seed ? seed : 0x9e3779b97f4a7c15ULL;
+	net->latency = latency;
+	net->proc_count = proc_count;
+	net->live = proc_count;
+	net->idle = 0;
+	net->epoch = 0;
+	net->owing = 0;
+	net->closed = calloc(proc_count, sizeof(char));
+	net->links = calloc(proc_count * proc_count, sizeof(SimLink));
+	if (net->closed == NULL || net->links == NULL){
+		sim_net_destroy(net);
+		return NULL;
+	}
+	return net;
+}
+
+void sim_net_destroy(SimNet* net){
+	size_t i;
+
+	if (net->links != NULL){
+		for (i = 0; i < net->proc_count * net->proc_count; i++){
+			sim_link_drop(&net->links[i]);
+		}
+	}
+	free(net->links);
+	free(net->closed);
+	free(net);
+}
+
+/** Get the link carrying messages from process from to process to */
+SimLink* sim_link_get(SimNet* net, size_t from, size_t to){
+	return net->links + from * net->proc_count + to;
+}
+
+/* xorshift64*, the same sequence on every run with the same seed */
+static uint64_t sim_random(SimNet* net){
+	net->rng ^= net->rng >> 12;
+	net->rng ^= net->rng << 25;
+	net->rng ^= net->rng >> 27;
+	return net->rng * 0x2545f4914f6cdd1dULL;
+}
+
+static long sim_delay(SimNet* net){
+	unsigned long span = net->latency.max - net->latency.min + 1;
+
+	return net->latency.min + (long) (sim_random(net) % span);
+}
+
+/** Put a message on the link, it is delivered after a delay drawn from the latency
+ *
+ * @return -1 if memory is exhausted, 0 on success
+ */
+int sim_link_push(SimNet* net, SimLink* link, const void* data, size_t len){
+	SimFrame* frame = malloc(sizeof(SimFrame) + len);
+	long deliver_at = net->now + sim_delay(net);
+
+	if (frame == NULL){
+		return -1;
+	}
+	/* A link is FIFO like a pipe, a short delay waits for the longer one before it */
+	if (deliver_at < link->last_delivery){
+		deliver_at = link->last_delivery;
+	}
+	link->last_delivery = deliver_at;
+	frame->next = NULL;
+	frame->sent_at = net->now;
+	frame->deliver_at = deliver_at;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+	if (link->tail == NULL){
+		link->head = frame;
+	}
+	else{
+		link->tail->next = frame;
+	}
+	link->tail = frame;
+	return 0;
+}
+
+/* Whether the oldest message of the link has arrived by now */
+int sim_link_ready(SimNet* net, SimLink* link){
+	return link->head != NULL && link->head->deliver_at <= net->now;
+}
+
+/** Take the oldest message of the link if it has arrived
+ *
+ * @param in_flight	Ticks the message spent on the link, set on success
+ *
+ * @return -1 if nothing has arrived or the message does not fit, its length otherwise
+ */
+int sim_link_pop(SimNet* net, SimLink* link, void* data, size_t capacity, long* in_flight){
+	SimFrame* frame = link->head;
+	int len;
+
+	if (!sim_link_ready(net, link) || frame->len > capacity){
+		return -1;
+	}
+	memcpy(data, frame->data, frame->len);
+	len = frame->len;
+	*in_flight = frame->deliver_at - frame->sent_at;
+	if ((link->head = frame->next) == NULL){
+		link->tail = NULL;
+	}
+	free(frame);
+	return len;
+}
+
+/* Forget every message on the link, its receiver is gone */
+void sim_link_drop(SimLink* link){
+	SimFrame* frame;
+
+	while ((frame = link->head) != NULL){
+		link->head = frame->next;
+		free(frame);
+	}
+	link->tail = NULL;
+}
+
+/** Move the clock to the earliest delivery still pending
+ *
+ * @return -1 if no message is on its way, 0 on success
+ */
+int sim_advance(SimNet* net){
+	long next = -1;
+	size_t i;
+
+	for (i = 0; i < net->proc_count * net->proc_count; i++){
+		SimFrame* head = net->links[i].head;
+
+		if (head != NULL && head->deliver_at > net->now && (next < 0 || head->deliver_at < next)){
+			next = head->deliver_at;
+		}
+	}
+	if (next < 0){
+		return -1;
+	}
+	net->now = next;
+	return 0;
+}
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include "spawn.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+static struct timespec startup_start;
+
+/** Fork processes 1..proc_count-1, the caller is process 0
+ *
+ * Serially the caller forks everybody. As a tree process k forks k + step
+ * for each power of two step above k, so all processes exist after
+ * log2(proc_count) rounds of forks running in parallel. Every process
+ * reaps only its own direct children.
+ *
+ * @param proc_count	Process count including parent process.
+ * @param tree		Fork as a binomial tree rather than serially
+ * @param children	Pids of the direct children, room for proc_count - 1
+ * @param child_count	Count of the direct children, set here
+ *
+ * @return -1 on fork error, local id of the calling process otherwise
+ */
+int spawn_processes(size_t proc_count, int tree, pid_t* children, size_t* child_count){
+	size_t id = 0, step;
+	pid_t pid;
+
+	*child_count = 0;
+	if (!tree){
+		for (step = 1; step < proc_count; step++){
+			if ((pid = fork()) < 0){
+				return -1;
+			}
+			if (!pid){
+				*child_count = 0;
+				return step;
+			}
+			children[(*child_count)++] = pid;
+		}
+		return 0;
+	}
+
+	for (step = 1; step < proc_count; step *= 2){
+		if (id >= step || id + step >= proc_count){
+			continue;
+		}
+		if ((pid = fork()) < 0){
+			return -1;
+		}
+		if (!pid){
+			id += step;
+			*child_count = 0;
+			continue;
+		}
+		children[(*child_count)++] = pid;
+	}
+	return id;
+}
+
+/* Wait for the direct children, each of them waits for its own first */
+void reap_children(const pid_t* children, size_t child_count){
+	size_t i;
+
+	for (i = 0; i < child_count; i++){
+		waitpid(children[i], NULL, 0);
+	}
+}
+
+/* Start the startup clock before opening channels, forked processes and threads share it */
+void startup_begin(void){
+	clock_gettime(CLOCK_MONOTONIC, &startup_start);
+}
+
+/**
+ * @return microseconds since startup_begin()
+ */
+long startup_elapsed_us(void){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - startup_start.tv_sec) * 1000000L + (now.tv_nsec - startup_start.tv_nsec) / 1000;
+}
@@ -0,0 +1,250 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_TRANSPORT__H
+#define __IFMO_DISTRIBUTED_CLASS_TRANSPORT__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ipc.h"
+
+/* Defined in communication.h, every lab adds its own fields */
+typedef struct PipesCommunication PipesCommunication;
+
+/* How blocking calls spend idle rounds: spin_limit busy-wait rounds,
+ * then yield_limit sched_yield() rounds, then park in the kernel until a
+ * sender signals, or keep yielding when park is 0. */
+typedef struct{
+	size_t spin_limit;
+	size_t yield_limit;
+	int park;
+} WaitPolicy;
+
+/* Idle rounds spent in each phase of WaitPolicy */
+typedef struct{
+	size_t spins;
+	size_t yields;
+	size_t parks;
+} WaitStats;
+
+// Not extern for simplicity only
+static const WaitPolicy default_wait_policy = {100, 10, 1};
+
+enum {
+	READ_AHEAD_SIZE = 4 * sizeof(Message),
+	RECEIVE_BATCH = 8,	/* messages the labs take per receive_many() */
+	SEND_BATCH = 8		/* items send_batch() hands a transport at once */
+};
+
+/* One message of a send_batch(), every item may go to another peer */
+typedef struct{
+	local_id dst;
+	const Message* message;
+} SendItem;
+
+/* Bytes read from a peer ahead of the messages receive() returned,
+ * data[start, end) may end with a partial frame */
+typedef struct{
+	char data[READ_AHEAD_SIZE];
+	size_t start;
+	size_t end;
+} ReadAhead;
+
+enum {
+	/* Largest write of queued messages, within PIPE_BUF so it is all or nothing,
+	 * below MAX_MESSAGE_LEN as the runtime kills writers of sizeof(Message) bytes */
+	OUT_WRITE_MAX = MAX_MESSAGE_LEN - 1,
+	/* Default bytes queued for a peer before send() refuses more */
+	OUT_HIGH_WATER = 1 << 20
+};
+
+/* Messages sent to a peer but not written yet, data[start, len) */
+typedef struct{
+	char* data;
+	size_t start;
+	size_t len;
+	size_t cap;
+	int watched;	/* epoll reports when the pipe gets room */
+} OutQueue;
+
+typedef struct{
+	size_t writes;		/* write() calls that wrote something */
+	size_t partial;		/* writes the pipe took only part of */
+	size_t full;		/* flushes stopped by a full pipe */
+	size_t throttled;	/* sends refused at the high-water mark */
+	size_t max_queued;	/* most bytes ever queued for one peer */
+} OutStats;
+
+/* Messages of one sender taken off the channel before receive() asked for them, data[start, len) */
+typedef struct{
+	char* data;
+	size_t start;
+	size_t len;
+	size_t cap;
+} InboxStash;
+
+enum {
+	MAILBOX_TYPES = CS_RELEASE + 1	/* MessageType values with a mailbox of their own */
+};
+
+/* Messages of one peer that receive_type() passed over while it looked
+ * for another type, one stash per MessageType and a last one for any
+ * other s_type. Each message is stored behind its arrival number, so
+ * receive() still hands them out in the order the peer sent them. */
+typedef struct{
+	InboxStash types[MAILBOX_TYPES + 1];
+	uint32_t arrivals;	/* number of the next message put aside */
+	size_t count;		/* messages waiting in all stashes */
+} Mailbox;
+
+/* Lanes of the messages from one peer. receive_any() hands out control
+ * messages first, bulk payloads wait while any peer has a control message;
+ * each lane keeps the order the peer sent in. */
+typedef enum{
+	LANE_CONTROL = 0,
+	LANE_BULK
+} MessageLane;
+
+/* io_uring state of one peer: a read stays posted into its ReadAhead,
+ * one write is in flight from flight while later sends accumulate in out */
+typedef struct{
+	int reading;
+	int closed;
+	char* out;
+	size_t out_len;
+	size_t out_cap;
+	char* flight;
+	size_t flight_len;
+	size_t flight_done;
+	size_t flight_cap;
+} UringChannel;
+
+/* Lamport time that does not wrap around in long runs */
+typedef int64_t wide_timestamp_t;
+
+enum {
+	WIRE_V1 = 1,	/* MessageHeader of ipc.h as is, what libruntime understands */
+	WIRE_V2 = 2,	/* MessageHeader followed by payload and a WireTrailer */
+	MESSAGE_MAGIC_V2 = 0xAFB2
+};
+
+/* Wide fields of a v2 message. The trailer travels behind the payload and
+ * is counted in s_payload_len, so every transport frames v2 messages like
+ * v1 ones; receive() strips it again and leaves MESSAGE_MAGIC_V2 in the
+ * header to tell the trailer is still behind the payload. */
+typedef struct{
+	int64_t s_local_time;
+	int32_t s_src;
+	int16_t s_version;
+	uint8_t s_folded;	/* empty messages of s_folded_type that ride on this one */
+	uint8_t s_folded_type;
+} WireTrailer;
+
+enum {
+	FOLD_MAX = UINT8_MAX	/* most messages one message carries along */
+};
+
+/* Empty messages of one type owed to a peer, the next message to the
+ * peer carries them in its WireTrailer; header is the latest of them */
+typedef struct{
+	MessageHeader header;
+	size_t count;
+} FoldQueue;
+
+/* Prefix of the payload of every fragment of a message too long for one Message */
+typedef struct{
+	uint32_t s_id;		/* counts the streams of the sender */
+	uint32_t s_offset;	/* of the data the fragment carries within the whole message */
+	uint32_t s_total;	/* bytes of the whole message */
+	int16_t s_type;		/* type of the whole message */
+	int16_t s_reserved;
+} FragmentHeader;
+
+/* Payload of a MESSAGE_HANDLE message, the data itself waits in the shared arena */
+typedef struct{
+	uint32_t s_offset;	/* of the data in the arena */
+	uint32_t s_len;
+	int16_t s_type;		/* type of the data */
+	int16_t s_reserved;
+} ShmHandle;
+
+enum {
+	MESSAGE_FRAGMENT = 0x100,	/* s_type of fragments, never a MessageType */
+	MESSAGE_HANDLE = 0x101,		/* s_type of handles */
+	FRAGMENT_CHUNK = MAX_PAYLOAD_LEN - sizeof(FragmentHeader) - sizeof(WireTrailer)
+};
+
+/* A long message read piece by piece as its fragments arrive */
+typedef struct{
+	int started;
+	MessageHeader header;	/* of the whole message: type and time of its first fragment */
+	wide_timestamp_t time;
+	uint32_t id;
+	size_t total;
+	size_t offset;		/* bytes returned so far */
+	Message fragment;	/* the fragment being returned */
+	size_t fragment_pos;
+	size_t fragment_end;
+} MessageStream;
+
+/* receive() result when the peer closed its end and nothing is left */
+enum { RECEIVE_CLOSED = -4 };
+
+/* receive_timed() result when the deadline passed before a message arrived */
+enum { RECEIVE_TIMEOUT = -5 };
+
+/* Operations of a message transport, ipc.h calls dispatch through them.
+ * send and receive never block, they return -2 when the channel is full
+ * or empty and the caller waits by wait policy. Optional operations are NULL. */
+typedef struct{
+	const char* name;
+	/* Channels between all proc_count processes, called once before fork(), NULL on error */
+	void* (*open)(size_t proc_count);
+	/* Channels of process id launched on its own, found through the peers file; NULL if unsupported */
+	void* (*join)(const char* peers, size_t proc_count, local_id id);
+	/* Keep the channels of comm->current_id, release the rest, -1 on error */
+	int (*attach)(PipesCommunication* comm, void* channels);
+	int (*send)(PipesCommunication* comm, local_id dst, const Message* message);
+	int (*receive)(PipesCommunication* comm, local_id from, Message* message);
+	/* One send to all peers, -2 without room for it; NULL sends to peers one by one */
+	int (*multicast)(PipesCommunication* comm, const Message* message);
+	/* Send items in order until one finds no room, return the count sent or -1 if the first one fails
+	 * with an error; NULL sends them one by one */
+	int (*send_batch)(PipesCommunication* comm, const SendItem* items, size_t n);
+	/* Mark peers that may have a message in comm->ready, receive_any() takes them round-robin */
+	int (*poll)(PipesCommunication* comm, int timeout);
+	/* Sleep until the peer has a message (POLLIN) or room for len bytes (POLLOUT) */
+	int (*park)(PipesCommunication* comm, local_id peer, short events, size_t len);
+	int (*flush)(PipesCommunication* comm);
+	/* Write out what send() accepted and release the channels of comm; NULL if it has nothing of its own */
+	void (*close)(PipesCommunication* comm);
+	/* Release the channels participants sharing one process attached to, after all of them closed; NULL under fork() */
+	void (*release)(void* channels, size_t proc_count);
+} Transport;
+
+extern const Transport pipe_transport;
+extern const Transport shm_transport;
+extern const Transport uds_transport;
+extern const Transport tcp_transport;
+extern const Transport inbox_transport;
+extern const Transport thread_transport;
+extern const Transport fiber_transport;
+extern const Transport sim_transport;
+
+const Transport* transport_find(const char* name);
+
+/* Index of the peer's slots in per-process tables that skip the process itself */
+#define GET_INDEX(x, id) ((x) < (id) ? (x) : (x) - 1)
+
+int sim_transport_configure(const char* latency, unsigned long seed);
+long sim_time(PipesCommunication* comm);
+
+MessageLane message_lane(const Message* message);
+wide_timestamp_t message_time(const Message* message);
+int stash_put(InboxStash* stash, const void* message, size_t len);
+int stash_take(InboxStash* stash, Message* message);
+
+int wait_idle(PipesCommunication* comm, size_t* round, local_id peer, short events, size_t len);
+int wake_fd(PipesCommunication* comm);
+long wake_in_us(PipesCommunication* comm);
+int fold_flush(PipesCommunication* comm);
+size_t fold_owed(PipesCommunication* comm);
+
+#endif
@@ -18,7 +18,8 @@ void transfer(void * parent_data, local_id src, local_id dst, balance_t amount){
 	
 	log_transfer_out(src, dst, amount);
 		
-    while (receive(parent, dst, &message) < 0 || message.s_header.s_type != ACK);
+	/* Anything else dst sends meanwhile waits in its mailboxes instead of being dropped */
+	while (receive_type_blocking(parent, dst, ACK, &message) < 0);
 	
 	log_transfer_in(src, dst, amount);		
 }
@@ -7,72 +7,26 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-
-
-int set_nonblock(int pipe_id);
-
-int* pipes_init(size_t proc_count){
-	
-
-	int* pipes = malloc(sizeof(int) * proc_count * (proc_count-1)*2);
-	size_t i, j;
-	size_t offset = proc_count - 1;
-	for (i = 0; i < proc_count; i++){
-		for (j = 0; j < proc_count; j++){
-			int tmp_fd[2];
-			
-			if (i == j){
-				continue;
-			}
-			
-			if (pipe(tmp_fd) < 0){
-				return (int*)NULL;
-			}
-			
-			if (set_nonblock(tmp_fd[0]) || set_nonblock(tmp_fd[1])){
-				return (int*)NULL;
-			}
-			pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE] = tmp_fd[0];  
-			pipes[j * offset * 2 + (j > i ? i : i - 1) * 2 + PIPE_WRITE_TYPE] = tmp_fd[1]; 
-		}
-	}
-	return pipes;
-}
 
 
-PipesCommunication* communication_init(int* pipes, size_t proc_count, local_id curr_proc, balance_t balance){
-	PipesCommunication* this = malloc(sizeof(PipesCommunication));;
-	size_t i, j;
-	size_t offset = proc_count - 1;
-	this->pipes = malloc(sizeof(int) * offset * 2);
+PipesCommunication* communication_init(const Transport* transport, void* channels, size_t proc_count, local_id curr_proc, balance_t balance){
+	PipesCommunication* this = malloc(sizeof(PipesCommunication));
+	
+	this->transport = transport;
 	this->total_ids = proc_count;
 	this->current_id = curr_proc;
 	this->balance = balance;
+	this->last_msg_from = curr_proc;
 	
-	memcpy(this->pipes, pipes + curr_proc * 2 * offset, sizeof(int) * offset * 2);
-	
-	/* Close unnecessary fds */
-	for (i = 0; i < proc_count; i++){
-		if (i == curr_proc){
-			continue;
-		}
-		for (j = 0; j < proc_count; j++){
-			close(pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE]);
-			close(pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_WRITE_TYPE]);
-		}
+	if (transport_attach(this, channels) < 0){
+		return NULL;
 	}
-	free(pipes);
 	return this;
 }
 
 
 void communication_destroy(PipesCommunication* comm){
-	size_t i;
-	for (i = 0; i < comm->total_ids - 1; i++){
-		close(comm->pipes[i * 2 + PIPE_READ_TYPE]);
-		close(comm->pipes[i * 2 + PIPE_WRITE_TYPE]);
-	}
+	transport_detach(comm); // flushes pending sends and closes channels
 	free(comm);
 }
 
@@ -133,7 +87,7 @@ void send_transfer_msg(PipesCommunication* comm, local_id dst, TransferOrder* or
 	
 	memcpy(message.s_payload, order, message.s_header.s_payload_len);
 	
-	while (send(comm, dst, &message) < 0);
+	send_blocking(comm, dst, &message);
 }
 
 /** Send ACK message */
@@ -144,7 +98,7 @@ void send_ack_msg(PipesCommunication* comm, local_id dst){
    	message.s_header.s_local_time = get_physical_time();
 	message.s_header.s_payload_len = 0;
 	
-	while (send(comm, dst, &message) < 0);
+	send_blocking(comm, dst, &message);
 }
 
 
@@ -157,7 +111,7 @@ void send_balance_history(PipesCommunication* comm, local_id dst, BalanceHistory
 	
 	memcpy(message.s_payload, history, message.s_header.s_payload_len);
 	
-	while (send(comm, dst, &message) < 0);
+	send_blocking(comm, dst, &message);
 }
 
 
@@ -169,7 +123,7 @@ void receive_all_msgs(PipesCommunication* comm, MessageType type){
 		if (i == comm->current_id){
 			continue;
 		}
-		while (receive(comm, i, &message) < 0);
+		receive_type_blocking(comm, i, type, &message);
 	}
 	
 	switch (type){
@@ -184,16 +138,3 @@ void receive_all_msgs(PipesCommunication* comm, MessageType type){
     }
 }
 
-
-int set_nonblock(int pipe_id){
-	int ff = fcntl(pipe_id, F_GETFL);
-    if (ff == -1){
-        return -1;
-    }
-    ff = fcntl(pipe_id, F_SETFL, ff | O_NONBLOCK);
-    if (ff == -1){
-        return -2;
-    }
-    return 0;
-}
-
@@ -4,14 +4,60 @@
 #define __IFMO_DISTRIBUTED_CLASS_COMMUNICATION__H
 
 #include "ipc.h"
+#include "transport.h"
+#include "shm_ring.h"
+#include "uring.h"
+#include "sim.h"
+#include "shm_arena.h"
+#include "timer.h"
 #include "banking.h"
 
-typedef struct{
+struct PipesCommunication{
+	const Transport* transport;
 	int* pipes;
+	int seqpacket;
+	int inbox;
+	int inbox_owner;
+	InboxStash* stash;
+	ShmRing* shm;
+	uint32_t shm_seq;
+	Uring* uring;
+	UringChannel* channels;
+	ReadAhead* inbound;
+	OutQueue* outbound;
+	int out_framed;
+	size_t out_high_water;
+	OutStats out_stats;
 	local_id current_id;
 	size_t total_ids;
 	balance_t balance;
-} PipesCommunication;
+	local_id last_msg_from;
+	int epoll_fd;
+	size_t poll_count;
+	char* ready;
+	char* closed;	/* peers seen to close their end without EOF of their own, no longer in poll_count */
+	InboxStash* bulk;	/* bulk lane of each peer, see receive_any() */
+	InboxStash* fragments;	/* fragments of each peer, see receive_stream() */
+	Mailbox* mailboxes;	/* messages of each peer receive_type() put aside */
+	FoldQueue* folds;	/* messages owed to each peer, see send_folded() */
+	InboxStash* unfolded;	/* what the last carrier of each peer brought that is not read yet, see channel_receive() */
+	long fold_delay;	/* microseconds send_folded() holds messages, -1 sends them at once */
+	uint32_t stream_seq;
+	ShmArena* arena;	/* shared with the other processes for send_handle(), NULL if there is none */
+	int wire_offer;	/* highest wire version this process speaks */
+	char* wire;	/* wire version of each peer, 0 until its first message */
+	wide_timestamp_t (*wide_clock)(void);	/* full clock for v2 messages, NULL widens s_local_time */
+	WaitPolicy wait;
+	WaitStats wait_stats;
+	TimerSet timers;	/* periodic work run while comm waits */
+	int64_t deadline;	/* monotonic_us() the running receive_timed() gives up at, -1 for none */
+	int timer_polled;	/* timers.fd is in the epoll set */
+	long startup_us;
+	SimNet* sim;
+	size_t sim_epoch;
+	size_t sim_owed;	/* what comm owed when it last waited, counted in sim->owing */
+	SimStats sim_stats;
+};
 
 enum PipeTypeOffset 
 {
@@ -19,10 +65,45 @@ enum PipeTypeOffset
     PIPE_WRITE_TYPE
 };
 
-int* pipes_init(size_t proc_count);
-PipesCommunication* communication_init(int* pipes, size_t proc_count, local_id curr_proc, balance_t balance);
+PipesCommunication* communication_init(const Transport* transport, void* channels, size_t proc_count, local_id curr_proc, balance_t balance);
 void communication_destroy(PipesCommunication* comm);
 
+int transport_attach(PipesCommunication* comm, void* channels);
+int poller_wait(PipesCommunication* comm, int timeout);
+void transport_detach(PipesCommunication* comm);
+int uring_start(PipesCommunication* comm);
+
+/** Write out messages queued by send() for all peers
+ *
+ * send() queues messages per peer, they go out once a whole write is
+ * queued, whenever the process waits for messages, or on flush().
+ *
+ * @param self    Any data structure which is useful for the student.
+ *
+ * @return 0 on success, any non-zero value if some pipe has no room yet.
+ */
+int flush(void * self);
+
+int send_batch(void * self, const SendItem * items, size_t n);
+int receive_many(void * self, Message * buf, size_t cap, local_id * from);
+int receive_type(void * self, local_id from, int16_t type, Message * message);
+int receive_blocking(PipesCommunication* comm, local_id from, Message* message);
+int receive_type_blocking(PipesCommunication* comm, local_id from, int16_t type, Message* message);
+int receive_timed(void * self, local_id from, Message * message, int64_t deadline);
+int receive_any_timed(void * self, Message * message, int64_t deadline);
+int send_blocking(PipesCommunication* comm, local_id dst, const Message* message);
+int send_batch_blocking(PipesCommunication* comm, const SendItem* items, size_t n);
+int fold_start(PipesCommunication* comm, long delay_us);
+int send_folded(PipesCommunication* comm, const SendItem* items, size_t n);
+
+void message_stream_init(MessageStream* stream);
+int send_stream(PipesCommunication* comm, local_id dst, const MessageHeader* header, const void* data, size_t len);
+int receive_stream(PipesCommunication* comm, local_id from, MessageStream* stream, void* buf, size_t cap);
+
+int send_handle(PipesCommunication* comm, local_id dst, const MessageHeader* header, void* data, size_t len);
+const void* message_payload(PipesCommunication* comm, const Message* message, size_t* len, int16_t* type);
+void message_payload_release(PipesCommunication* comm, const Message* message);
+
 int send_all_proc_event_msg(PipesCommunication* comm, MessageType type);
 void send_all_stop_msg(PipesCommunication* comm);
 void send_transfer_msg(PipesCommunication* comm, local_id dst, TransferOrder* order);
@@ -50,7 +50,12 @@ void log_destroy(){
 void log_pipes(PipesCommunication* comm){
 	size_t i;
 	
-	fprintf(pipes_log_f, "Process %d pipes:\n", comm->current_id);
+	if (comm->pipes == NULL){
+		fprintf(pipes_log_f, "Process %d uses %s transport\n", comm->current_id, comm->transport->name);
+		return;
+	}
+	
+	fprintf(pipes_log_f, "Process %d %s:\n", comm->current_id, comm->seqpacket ? "sockets" : "pipes");
 	
 	for (i = 0; i < comm->total_ids; i++){
 		if (i == comm->current_id){
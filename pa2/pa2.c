@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <getopt.h>
 #include "log2pa.h"
 #include "communication.h"
 #include "banking.h"
@@ -67,9 +68,7 @@ int do_parent_work(PipesCommunication* comm){
 		BalanceHistory balance_history;
 		Message msg;
 		
-		while(receive(comm, i, &msg));
-		
-		if (msg.s_header.s_type != BALANCE_HISTORY){
+		if (receive_type_blocking(comm, i, BALANCE_HISTORY, &msg)){
 			return -1;
 		}
 		
@@ -131,30 +130,57 @@ int do_child_work(PipesCommunication* comm){
 
 
 
-int get_proc_count(int argc, char** argv){
-	int proc_count;
-	if (!strcmp(argv[1], "-p") && (proc_count = atoi(argv[2])) == (argc - 3)){
-		return proc_count;
+/** Parse -p X [--transport=NAME] followed by X balances
+ *
+ * @return -1 on invalid arguments, index of the first balance in argv otherwise
+ */
+int get_agrs(int argc, char** argv, int* processes, const Transport** transport){
+	int res;
+	const struct option long_options[] = {
+        {"transport", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+	
+	*processes = -1;
+	*transport = &pipe_transport;
+	
+	while ((res = getopt_long(argc, argv, "p:", long_options, NULL)) != -1){
+		if (res == 'p'){
+			*processes = atoi(optarg);
+		}
+		else if (res == 't'){
+			if ((*transport = transport_find(optarg)) == NULL){
+				return -1;
+			}
+		}
+		else if (res == '?'){
+			return -1;
+		}
 	}
-	return -1;
+	if (*processes <= 0 || *processes != argc - optind){
+		return -1;
+	}
+	return optind;
 }
 
 
-balance_t get_proc_balance(local_id proc_id, char** argv){
-	return atoi(argv[proc_id + 2]);
+balance_t get_proc_balance(local_id proc_id, char** balances){
+	return proc_id == PARENT_ID ? 0 : atoi(balances[proc_id - 1]);
 }
 int main(int argc, char** argv){
 	size_t i;
 	int proc_count;
-	int* pipes;
+	int first_balance;
+	const Transport* transport;
+	void* channels;
 	pid_t* children;
 	pid_t fork_id;
 	local_id current_proc_id;
 	PipesCommunication* comm;
 	
 	
-	if (argc < 4 || (proc_count = get_proc_count(argc, argv)) == -1){
-		fprintf(stderr, "Usage: %s -p X y1 y2 ... yX\n", argv[0]);
+	if (argc < 4 || (first_balance = get_agrs(argc, argv, &proc_count, &transport)) == -1){
+		fprintf(stderr, "Usage: %s -p X [--transport=pipe|shm|uds|tcp|inbox] y1 y2 ... yX\n", argv[0]);
 		return -1;
 	}
 	
@@ -162,7 +188,11 @@ int main(int argc, char** argv){
 	
 	children = malloc(sizeof(pid_t) * proc_count);
 	
-	pipes = pipes_init(proc_count + 1); // open pipes 
+	channels = transport->open(proc_count + 1); // open pipes, sockets or rings 
+	if (channels == NULL){
+		fprintf(stderr, "Can not open %s channels for %d processes\n", transport->name, proc_count + 1);
+		return -2;
+	}
 	
 	for (i = 0; i < proc_count; i++){
 		fork_id = fork();
@@ -185,7 +215,7 @@ int main(int argc, char** argv){
 	}
 	
 	
-	comm = communication_init(pipes, proc_count + 1, current_proc_id, 		    get_proc_balance(current_proc_id, argv));
+	comm = communication_init(transport, channels, proc_count + 1, current_proc_id, 		    get_proc_balance(current_proc_id, argv + first_balance));
 	log_pipes(comm);
 	
 	
@@ -0,0 +1,38 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_SHM_ARENA__H
+#define __IFMO_DISTRIBUTED_CLASS_SHM_ARENA__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+enum {
+	SHM_ARENA_ALIGN = 16	/* every block starts at a multiple of it */
+};
+
+/* Prefix of every block of the arena, free blocks have no references */
+typedef struct{
+	uint32_t size;		/* bytes of the block including this header */
+	uint32_t refs;
+	char pad[SHM_ARENA_ALIGN - 2 * sizeof(uint32_t)];
+} ShmBlock;
+
+/* Memory mapped before fork() that processes hand large payloads over in,
+ * blocks are allocated first-fit under a process-shared mutex and freed
+ * when the last reference is released */
+typedef struct{
+	pthread_mutex_t lock;
+	size_t size;		/* bytes of blocks behind the arena header */
+} ShmArena;
+
+ShmArena* shm_arena_init(size_t size);
+void shm_arena_destroy(ShmArena* arena);
+
+void* shm_arena_alloc(ShmArena* arena, size_t len);
+void shm_arena_retain(ShmArena* arena, void* data);
+void shm_arena_release(ShmArena* arena, void* data);
+
+int shm_arena_contains(ShmArena* arena, const void* data);
+uint32_t shm_arena_offset(ShmArena* arena, const void* data);
+void* shm_arena_data(ShmArena* arena, uint32_t offset);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_SIM__H
+#define __IFMO_DISTRIBUTED_CLASS_SIM__H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ticks of virtual time a message spends on a link, drawn from [min, max] */
+typedef struct{
+	long min;
+	long max;
+} SimLatency;
+
+/* A message on its way over a link */
+typedef struct SimFrame{
+	struct SimFrame* next;
+	long sent_at;
+	long deliver_at;
+	size_t len;
+	char data[];
+} SimFrame;
+
+/* Messages of one (src, dst) pair in send order, deliveries never overtake each other */
+typedef struct{
+	SimFrame* head;
+	SimFrame* tail;
+	long last_delivery;
+} SimLink;
+
+/* Network of the whole run under virtual time. The clock only moves when
+ * every live participant waits and nothing it waits for is delivered yet,
+ * then it jumps to the earliest delivery. */
+typedef struct{
+	long now;
+	uint64_t rng;
+	SimLatency latency;
+	size_t proc_count;
+	size_t live;		/* participants not closed yet */
+	size_t idle;		/* participants that waited since the last progress */
+	size_t epoch;		/* bumped by every progress */
+	size_t owing;		/* messages waiting participants owe to peers, see send_folded() */
+	char* closed;
+	SimLink* links;
+} SimNet;
+
+/* Traffic of one participant, in_flight sums ticks its received messages spent on links */
+typedef struct{
+	size_t sent;
+	size_t received;
+	long in_flight;
+} SimStats;
+
+int sim_latency_parse(const char* spec, SimLatency* latency);
+
+SimNet* sim_net_init(size_t proc_count, SimLatency latency, uint64_t seed);
+void sim_net_destroy(SimNet* net);
+SimLink* sim_link_get(SimNet* net, size_t from, size_t to);
+
+int sim_link_push(SimNet* net, SimLink* link, const void* data, size_t len);
+int sim_link_ready(SimNet* net, SimLink* link);
+int sim_link_pop(SimNet* net, SimLink* link, void* data, size_t capacity, long* in_flight);
+void sim_link_drop(SimLink* link);
+int sim_advance(SimNet* net);
+
+#endif
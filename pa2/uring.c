@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct Uring{
+	int fd;
+	void* rings;
+	size_t rings_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	unsigned* sq_tail;
+	unsigned* sq_head;
+	unsigned* sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+	unsigned to_submit;
+};
+
+/** Set up a ring with room for entries operations in flight
+ *
+ * @return NULL if io_uring is unavailable, ring otherwise
+ */
+Uring* uring_init(unsigned entries){
+	struct io_uring_params params;
+	Uring* ring = calloc(1, sizeof(Uring));
+	size_t sq_size, cq_size;
+	char* base;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)){
+		free(ring);
+		return NULL;
+	}
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+	ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED){
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	base = ring->rings;
+	ring->sq_head = (unsigned*) (base + params.sq_off.head);
+	ring->sq_tail = (unsigned*) (base + params.sq_off.tail);
+	ring->sq_array = (unsigned*) (base + params.sq_off.array);
+	ring->sq_mask = *(unsigned*) (base + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head = (unsigned*) (base + params.cq_off.head);
+	ring->cq_tail = (unsigned*) (base + params.cq_off.tail);
+	ring->cq_mask = *(unsigned*) (base + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (base + params.cq_off.cqes);
+	return ring;
+}
+
+void uring_destroy(Uring* ring){
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->rings, ring->rings_size);
+	close(ring->fd);
+	free(ring);
+}
+
+static int uring_queue(Uring* ring, int opcode, int fd, const void* buf, unsigned len, uint64_t tag){
+	unsigned tail = *ring->sq_tail;
+	struct io_uring_sqe* sqe;
+
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries){
+		return -1;
+	}
+	sqe = &ring->sqes[tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) buf;
+	sqe->len = len;
+	sqe->off = (uint64_t) -1;	/* current position, pipes and sockets have none */
+	sqe->user_data = tag;
+	ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	return 0;
+}
+
+/** Queue a read, it is submitted by the next uring_enter()
+ *
+ * @return -1 if the submission queue is full, 0 on success
+ */
+int uring_read(Uring* ring, int fd, void* buf, unsigned len, uint64_t tag){
+	return uring_queue(ring, IORING_OP_READ, fd, buf, len, tag);
+}
+
+/** Queue a write, it is submitted by the next uring_enter()
+ *
+ * @return -1 if the submission queue is full, 0 on success
+ */
+int uring_write(Uring* ring, int fd, const void* buf, unsigned len, uint64_t tag){
+	return uring_queue(ring, IORING_OP_WRITE, fd, buf, len, tag);
+}
+
+/** Submit all queued operations with one syscall
+ *
+ * @param wait_nr	Completions to wait for, 0 to return immediately
+ *
+ * @return -1 on io_uring_enter error, 0 on success
+ */
+int uring_enter(Uring* ring, unsigned wait_nr){
+	int res;
+
+	if (!ring->to_submit && !wait_nr){
+		return 0;
+	}
+	res = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (res < 0){
+		return errno == EINTR || errno == EAGAIN || errno == EBUSY ? 0 : -1;
+	}
+	ring->to_submit -= res;
+	return 0;
+}
+
+/** Take one completion, no syscall involved
+ *
+ * @param tag	Tag of the completed operation
+ * @param res	Result of the operation, negated errno on failure
+ *
+ * @return -1 if no operation completed, 0 otherwise
+ */
+int uring_reap(Uring* ring, uint64_t* tag, int* res){
+	unsigned head = *ring->cq_head;
+	struct io_uring_cqe* cqe;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+		return -1;
+	}
+	cqe = &ring->cqes[head & ring->cq_mask];
+	*tag = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Operations queued but not yet submitted */
+unsigned uring_pending(Uring* ring){
+	return ring->to_submit;
+}
+
+/* The ring polls readable while completions wait to be reaped */
+int uring_fd(Uring* ring){
+	return ring->fd;
+}
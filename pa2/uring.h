@@ -0,0 +1,20 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_URING__H
+#define __IFMO_DISTRIBUTED_CLASS_URING__H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Minimal io_uring wrapper over raw syscalls, no liburing required */
+typedef struct Uring Uring;
+
+Uring* uring_init(unsigned entries);
+void uring_destroy(Uring* ring);
+
+int uring_read(Uring* ring, int fd, void* buf, unsigned len, uint64_t tag);
+int uring_write(Uring* ring, int fd, const void* buf, unsigned len, uint64_t tag);
+int uring_enter(Uring* ring, unsigned wait_nr);
+int uring_reap(Uring* ring, uint64_t* tag, int* res);
+unsigned uring_pending(Uring* ring);
+int uring_fd(Uring* ring);
+
+#endif
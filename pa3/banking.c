@@ -13,12 +13,16 @@ void transfer(void * parent_data, local_id src, local_id dst, balance_t amount){
         
 
         PipesCommunication* parent = (PipesCommunication*) parent_data;
+	long sent_at = sim_time(parent);
 	increment_lamport_time();
     	send_transfer_msg(parent, src, &transferorder);
 	
 	log_transfer_out(src, dst, amount);
 		
-    while (receive(parent, dst, &message) < 0 || message.s_header.s_type != ACK);
+	/* Anything else dst sends meanwhile waits in its mailboxes instead of being dropped */
+	while (receive_type_blocking(parent, dst, ACK, &message) < 0);
 	set_lamport_time_from_msg(&message);
+	parent->transfer_count++;
+	parent->transfer_time += sim_time(parent) - sent_at;
 	log_transfer_in(src, dst, amount);		
 }
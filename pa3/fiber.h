@@ -0,0 +1,22 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_FIBER__H
+#define __IFMO_DISTRIBUTED_CLASS_FIBER__H
+
+#include <stddef.h>
+
+enum {
+	FIBER_STACK_SIZE = 1 << 18	/* bytes of stack per fiber */
+};
+
+typedef struct FiberPool FiberPool;
+
+FiberPool* fiber_pool_init(size_t worker_count, size_t fiber_count);
+int fiber_spawn(FiberPool* pool, void (*run)(void*), void* arg, void* local);
+void fiber_pool_run(FiberPool* pool);
+void fiber_pool_destroy(FiberPool* pool);
+
+void fiber_yield(void);
+void fiber_wait(long timeout_us);
+void fiber_wake(void);
+void* fiber_local(void);
+
+#endif
@@ -0,0 +1,164 @@
+#include "ipc.h"
+#include "communication.h"
+#include "transport.h"
+#include "uds.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+
+static void* inboxes_open(size_t proc_count){
+	return uds_inbox_init(proc_count);
+}
+
+/* Keep the own inbox only, peers are reached by address */
+static int inboxes_attach(PipesCommunication* comm, void* channels){
+	int* inboxes = channels;
+	size_t i;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (i != comm->current_id){
+			close(inboxes[i]);
+		}
+	}
+	comm->inbox = inboxes[comm->current_id];
+	comm->inbox_owner = inboxes[comm->total_ids];
+	comm->stash = calloc(comm->total_ids, sizeof(InboxStash));
+	comm->poll_count = comm->total_ids - 1;
+	free(inboxes);
+	return 0;
+}
+
+/** Move everything waiting in the inbox to the stashes of the senders
+ *
+ * A bare sender id is the goodbye of inboxes_close(), nothing of that
+ * peer follows it.
+ *
+ * @return count of peers that have stashed messages, -1 on a malformed datagram or if memory is exhausted
+ */
+static int inbox_drain(PipesCommunication* comm){
+	Message message;
+	char from;
+	int len, ready = 0;
+	local_id i;
+
+	while ((len = uds_inbox_recv(comm->inbox, &from, &message, sizeof(Message))) >= 0){
+		if (from < 0 || (size_t) from >= comm->total_ids || from == comm->current_id){
+			return -1;
+		}
+		if (!len){
+			if (!comm->closed[(int) from]){
+				comm->closed[(int) from] = 1;
+				comm->poll_count--;
+			}
+			continue;
+		}
+		if (len < (int) sizeof(MessageHeader) || len != (int) sizeof(MessageHeader) + message.s_header.s_payload_len
+				|| stash_put(&comm->stash[(int) from], &message, len)){
+			return -1;
+		}
+	}
+	for (i = 0; i < comm->total_ids; i++){
+		if (comm->stash[i].start != comm->stash[i].len){
+			comm->ready[i] = 1;
+			ready++;
+		}
+	}
+	return ready;
+}
+
+static int inbox_receive(PipesCommunication* this, local_id from, Message* message){
+	if (!stash_take(&this->stash[from], message)){
+		return 0;
+	}
+	if (inbox_drain(this) < 0){
+		return -1;
+	}
+	if (!stash_take(&this->stash[from], message)){
+		return 0;
+	}
+	return this->closed[from] ? RECEIVE_CLOSED : -2;
+}
+
+/* A peer that exited has no inbox anymore, its messages are dropped like writes to a closed pipe */
+static int inbox_send(PipesCommunication* from, local_id dst, const Message* message){
+	return uds_inbox_send(from->inbox, from->inbox_owner, dst, from->current_id, message,
+		sizeof(MessageHeader) + message->s_header.s_payload_len) == -2 ? -2 : 0;
+}
+
+/* Watch the own inbox and, for the next timer or deadline, the timerfd */
+static int inbox_sleep(PipesCommunication* comm, int timeout){
+	struct pollfd pfd[2];
+	int count = 1;
+
+	pfd[0].fd = comm->inbox;
+	pfd[0].events = POLLIN;
+	if (timeout < 0 && (pfd[1].fd = wake_fd(comm)) >= 0){
+		pfd[1].events = POLLIN;
+		count++;
+	}
+	return poll(pfd, count, timeout);
+}
+
+static int inbox_poll(PipesCommunication* comm, int timeout){
+	int ready = inbox_drain(comm);
+
+	if (ready || !timeout || !comm->poll_count){
+		return ready;
+	}
+	if (inbox_sleep(comm, timeout) < 0){
+		return errno == EINTR ? 0 : -1;
+	}
+	return inbox_drain(comm);
+}
+
+/** Sleep on the own inbox
+ *
+ * A full peer inbox gives no wake-up, the sender naps for a millisecond
+ * and keeps its own inbox drained meanwhile, so two processes sending
+ * to each other never wait for one another.
+ */
+static int inbox_park(PipesCommunication* comm, local_id peer, short events, size_t len){
+	if (inbox_sleep(comm, events == POLLIN ? -1 : 1) < 0 && errno != EINTR){
+		return -1;
+	}
+	return inbox_drain(comm) < 0 ? -1 : 0;
+}
+
+/* Say goodbye to every peer still there, the inbox of one that exited refuses it */
+static void inboxes_close(PipesCommunication* comm){
+	size_t i;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (i == comm->current_id){
+			continue;
+		}
+		while (uds_inbox_send(comm->inbox, comm->inbox_owner, i, comm->current_id, NULL, 0) == -2
+				&& !inbox_park(comm, i, POLLOUT, 0));
+	}
+	for (i = 0; i < comm->total_ids; i++){
+		free(comm->stash[i].data);
+	}
+	free(comm->stash);
+	close(comm->inbox);
+}
+
+/* One datagram socket per process that every peer sends to, the sender id
+ * travels in front of each message: O(N) fds and one fd to wait on */
+const Transport inbox_transport = {
+	"inbox",
+	inboxes_open,
+	NULL,
+	inboxes_attach,
+	inbox_send,
+	inbox_receive,
+	NULL,
+	NULL,
+	inbox_poll,
+	inbox_park,
+	NULL,
+	inboxes_close,
+	NULL
+};
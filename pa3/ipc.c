@@ -1,65 +1,1258 @@
 #include "ipc.h"
 #include "communication.h"
-#include <unistd.h>
-#include "log3pa.h"
+#include "transport.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
 
-#define GET_INDEX(x, id) ((x) < (id) ? (x) : (x) - 1)
 
-int send(void * self, local_id dst, const Message * message);
+static const Transport* transports[] = {&pipe_transport, &shm_transport, &uds_transport, &tcp_transport, &inbox_transport};
+
+/** Look up a transport by the name given on the command line
+ *
+ * @return NULL if no transport has the name
+ */
+const Transport* transport_find(const char* name){
+	size_t i;
+
+	for (i = 0; i < sizeof(transports) / sizeof(transports[0]); i++){
+		if (!strcmp(transports[i]->name, name)){
+			return transports[i];
+		}
+	}
+	return NULL;
+}
+
+/* Texts and histories are bulk, everything the protocols wait on to move on is control */
+MessageLane message_lane(const Message* message){
+	switch (message->s_header.s_type){
+		case STARTED:
+		case DONE:
+		case BALANCE_HISTORY:
+		case MESSAGE_HANDLE:
+			return LANE_BULK;
+		default:
+			return LANE_CONTROL;
+	}
+}
+
+/** Append one message to the stash of its sender
+ *
+ * @return -1 if memory is exhausted, 0 on success
+ */
+int stash_put(InboxStash* stash, const void* message, size_t len){
+	if (stash->len + len > stash->cap){
+		if (stash->start){
+			memmove(stash->data, stash->data + stash->start, stash->len - stash->start);
+			stash->len -= stash->start;
+			stash->start = 0;
+		}
+		if (stash->len + len > stash->cap){
+			size_t cap = stash->cap ? stash->cap : sizeof(Message);
+			char* data;
+
+			while (cap < stash->len + len){
+				cap *= 2;
+			}
+			if ((data = realloc(stash->data, cap)) == NULL){
+				return -1;
+			}
+			stash->data = data;
+			stash->cap = cap;
+		}
+	}
+	memcpy(stash->data + stash->len, message, len);
+	stash->len += len;
+	return 0;
+}
+
+/* Take the oldest stashed message, -2 if the sender has none */
+int stash_take(InboxStash* stash, Message* message){
+	MessageHeader header;
+	size_t len;
+
+	if (stash->start == stash->len){
+		return -2;
+	}
+	memcpy(&header, stash->data + stash->start, sizeof(MessageHeader));
+	len = sizeof(MessageHeader) + header.s_payload_len;
+	memcpy(message, stash->data + stash->start, len);
+	stash->start += len;
+	if (stash->start == stash->len){
+		stash->start = stash->len = 0;
+	}
+	return 0;
+}
+
+static size_t mailbox_slot(int16_t type){
+	return type >= 0 && type < MAILBOX_TYPES ? (size_t) type : MAILBOX_TYPES;
+}
+
+/** Put a message of the peer aside in the mailbox of its type
+ *
+ * @return -1 if memory is exhausted, 0 on success
+ */
+static int mailbox_put(Mailbox* box, const Message* message){
+	char entry[sizeof(uint32_t) + sizeof(Message)];
+	size_t len = sizeof(MessageHeader) + message->s_header.s_payload_len;
+
+	memcpy(entry, &box->arrivals, sizeof(uint32_t));
+	memcpy(entry + sizeof(uint32_t), message, len);
+	if (stash_put(&box->types[mailbox_slot(message->s_header.s_type)], entry, sizeof(uint32_t) + len)){
+		return -1;
+	}
+	box->arrivals++;
+	box->count++;
+	return 0;
+}
+
+/** Take the oldest message put aside with the type, or of any type if type is -1
+ *
+ * @return -2 if the mailbox has no such message, 0 on success
+ */
+static int mailbox_take(Mailbox* box, int type, Message* message){
+	InboxStash* stash = NULL;
+	uint32_t oldest = 0;
+	size_t i;
+
+	if (!box->count){
+		return -2;
+	}
+	for (i = 0; i <= MAILBOX_TYPES; i++){
+		InboxStash* candidate = &box->types[i];
+		uint32_t arrival;
+
+		if (candidate->start == candidate->len || (type >= 0 && i != mailbox_slot(type))){
+			continue;
+		}
+		memcpy(&arrival, candidate->data + candidate->start, sizeof(uint32_t));
+		if (stash == NULL || (int32_t) (arrival - oldest) < 0){
+			stash = candidate;
+			oldest = arrival;
+		}
+	}
+	if (stash == NULL){
+		return -2;
+	}
+	stash->start += sizeof(uint32_t);
+	stash_take(stash, message);
+	box->count--;
+	return 0;
+}
+
+/* Version the peer gets, the offer until the first message of the peer tells its own */
+static int wire_version(PipesCommunication* comm, local_id peer){
+	return comm->wire[peer] ? comm->wire[peer] : comm->wire_offer;
+}
+
+/* The wide value with the low bits of low that lies nearest to reference */
+static wide_timestamp_t wide_time_near(wide_timestamp_t reference, timestamp_t low){
+	return reference + (timestamp_t) (low - (timestamp_t) reference);
+}
+
+/** Put message in the wire format of the peer
+ *
+ * A v2 message gets a WireTrailer with the full clock of the sender,
+ * widened from s_local_time around comm->wide_clock. A payload without
+ * room for the trailer goes out as v1.
+ *
+ * @param peer		Receiver, own id for a multicast to all peers
+ * @param frame		Buffer for the v2 message
+ * @param fold		Whether a v2 message to a single peer carries what is owed to it, see fold_settle()
+ *
+ * @return message itself for v1, frame for v2
+ */
+static const Message* wire_encode(PipesCommunication* comm, local_id peer, const Message* message, Message* frame, int fold){
+	size_t len = message->s_header.s_payload_len;
+	WireTrailer trailer;
+	int version = comm->wire_offer;
+	local_id i;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (i != comm->current_id && (peer == comm->current_id || i == peer) && wire_version(comm, i) < version){
+			version = wire_version(comm, i);
+		}
+	}
+	if (version < WIRE_V2 || len + sizeof(WireTrailer) > MAX_PAYLOAD_LEN){
+		return message;
+	}
+	trailer.s_local_time = comm->wide_clock != NULL ? wide_time_near(comm->wide_clock(), message->s_header.s_local_time)
+		: message->s_header.s_local_time;
+	trailer.s_src = comm->current_id;
+	trailer.s_version = WIRE_V2;
+	trailer.s_folded = fold && peer != comm->current_id ? comm->folds[peer].count : 0;
+	trailer.s_folded_type = trailer.s_folded ? comm->folds[peer].header.s_type : 0;
+	memcpy(frame, message, sizeof(MessageHeader) + len);
+	memcpy(frame->s_payload + len, &trailer, sizeof(WireTrailer));
+	frame->s_header.s_magic = MESSAGE_MAGIC_V2;
+	frame->s_header.s_payload_len = len + sizeof(WireTrailer);
+	return frame;
+}
+
+/* frame went out to peer, what wire_encode() folded into it is not owed anymore */
+static void fold_settle(PipesCommunication* comm, local_id peer, const Message* frame){
+	WireTrailer trailer;
+
+	memcpy(&trailer, frame->s_payload + frame->s_header.s_payload_len - sizeof(WireTrailer), sizeof(WireTrailer));
+	comm->folds[peer].count -= trailer.s_folded;
+}
+
+/** Strip the trailer of a v2 message and settle the version of the link
+ *
+ * The first message of a peer that had room for a trailer tells the
+ * highest version it speaks, the link uses the lower of that and the own
+ * offer from then on. A v1 message too long for a trailer tells nothing,
+ * wire_encode() sends those as v1 on any link.
+ */
+static void wire_decode(PipesCommunication* comm, local_id from, Message* message){
+	int version = message->s_header.s_magic == MESSAGE_MAGIC_V2 && message->s_header.s_payload_len >= sizeof(WireTrailer)
+		? WIRE_V2 : WIRE_V1;
+
+	if (!comm->wire[from] && (version == WIRE_V2 || message->s_header.s_payload_len + sizeof(WireTrailer) <= MAX_PAYLOAD_LEN)){
+		comm->wire[from] = version < comm->wire_offer ? version : comm->wire_offer;
+	}
+	if (version == WIRE_V2){
+		message->s_header.s_payload_len -= sizeof(WireTrailer);
+	}
+}
+
+/* Full time of a received message, s_local_time widened for v1 */
+wide_timestamp_t message_time(const Message* message){
+	WireTrailer trailer;
+
+	if (message->s_header.s_magic != MESSAGE_MAGIC_V2){
+		return message->s_header.s_local_time;
+	}
+	memcpy(&trailer, message->s_payload + message->s_header.s_payload_len, sizeof(WireTrailer));
+	return trailer.s_local_time;
+}
+
 int send_multicast(void * self, const Message * message){
 	PipesCommunication* from = (PipesCommunication*) self;
 	local_id i;
-	
-	for (i = 0; i < from->total_ids; i++){
-		if (i == from->current_id){
-			continue;
+
+	if (from->transport->multicast != NULL){
+		size_t round = 0;
+		Message frame;
+
+		/* One frame for all peers can not carry what each of them is owed, it goes out first */
+		fold_flush(from);
+		message = wire_encode(from, from->current_id, message, &frame, 0);
+		while (from->transport->multicast(from, message)){
+			if (wait_idle(from, &round, from->current_id, POLLOUT, sizeof(MessageHeader) + message->s_header.s_payload_len) < 0){
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	/* One batch to all peers, each transport gathers what it can */
+	{
+		SendItem items[MAX_PROCESS_ID + 1];
+		size_t count = 0;
+
+		for (i = 0; i < from->total_ids; i++){
+			if (i != from->current_id){
+				items[count].dst = i;
+				items[count++].message = message;
+			}
+		}
+		return send_batch_blocking(from, items, count);
+	}
+}
+
+/** Send the message of every item to its destination, in the order of items
+ *
+ * Up to SEND_BATCH items are encoded and handed to the transport at once,
+ * so a run of items to one peer can go out in a single system call. A full
+ * channel stops the batch at the first item it refuses; the caller waits
+ * for room to that item's destination and resumes from it.
+ *
+ * @param self    Any data structure which is useful for the student.
+ * @param items   Messages with their destinations
+ * @param n       Count of items
+ *
+ * @return -1 if some item is addressed to the sender itself or the first item
+ *         fails with an error and nothing was sent, count of leading items sent otherwise
+ */
+int send_batch(void * self, const SendItem * items, size_t n){
+	PipesCommunication* from = (PipesCommunication*) self;
+	Message frames[SEND_BATCH];
+	SendItem encoded[SEND_BATCH];
+	size_t sent = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++){
+		if (items[i].dst == from->current_id){
+			return -1;
+		}
+	}
+	while (sent < n){
+		size_t count = n - sent < SEND_BATCH ? n - sent : SEND_BATCH;
+		size_t taken = 0;
+		int res = 0;
+
+		for (i = 0; i < count; i++){
+			size_t j = 0;
+
+			/* The first item to a peer carries what is owed to it */
+			while (j < i && encoded[j].dst != items[sent + i].dst){
+				j++;
+			}
+			encoded[i].dst = items[sent + i].dst;
+			encoded[i].message = wire_encode(from, encoded[i].dst, items[sent + i].message, &frames[i], j == i);
+		}
+		if (from->transport->send_batch != NULL){
+			if ((res = from->transport->send_batch(from, encoded, count)) > 0){
+				taken = res;
+			}
+		}
+		else{
+			while (taken < count && !(res = from->transport->send(from, encoded[taken].dst, encoded[taken].message))){
+				taken++;
+			}
 		}
-		while(send(from, i, message) < 0);
+		for (i = 0; i < taken; i++){
+			if (encoded[i].message == &frames[i]){
+				fold_settle(from, encoded[i].dst, &frames[i]);
+			}
+		}
+		sent += taken;
+		if (taken < count){
+			/* An error counts only when it stopped the batch before anything went out */
+			if (res == -1 && !sent){
+				return -1;
+			}
+			break;
+		}
+	}
+	return sent;
+}
+
+/** Take the next message off the peer's channel and unfold what it carries
+ *
+ * Messages folded into a carrier by the peer's send_folded() were owed
+ * before the carrier was sent, so they come first and the carrier last.
+ * What is not returned yet waits in comm->unfolded, which is read before
+ * the channel and counts as part of it for poller_wait().
+ *
+ * @return receive() result of the transport, -1 if memory is exhausted
+ */
+static int channel_receive(PipesCommunication* comm, local_id from, Message* message){
+	WireTrailer trailer;
+	Message folded;
+	char* end;
+	size_t count;
+	int res;
+
+	if (!stash_take(&comm->unfolded[from], message)){
+		return 0;
+	}
+	if ((res = comm->transport->receive(comm, from, message))){
+		return res;
+	}
+	if (message->s_header.s_magic != MESSAGE_MAGIC_V2 || message->s_header.s_payload_len < sizeof(WireTrailer)){
+		return 0;
 	}
+	end = message->s_payload + message->s_header.s_payload_len - sizeof(WireTrailer);
+	memcpy(&trailer, end, sizeof(WireTrailer));
+	if (!(count = trailer.s_folded)){
+		return 0;
+	}
+	/* Each folded message is a bare trailer with the time of its carrier */
+	trailer.s_folded = 0;
+	memcpy(end, &trailer, sizeof(WireTrailer));
+	folded.s_header = message->s_header;
+	folded.s_header.s_type = trailer.s_folded_type;
+	folded.s_header.s_payload_len = sizeof(WireTrailer);
+	memcpy(folded.s_payload, &trailer, sizeof(WireTrailer));
+	while (--count){
+		if (stash_put(&comm->unfolded[from], &folded, sizeof(MessageHeader) + sizeof(WireTrailer))){
+			return -1;
+		}
+	}
+	if (stash_put(&comm->unfolded[from], message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+		return -1;
+	}
+	memcpy(message, &folded, sizeof(MessageHeader) + sizeof(WireTrailer));
 	return 0;
 }
 
+/* The next message of the peer as it came over the wire, the transport's result if there is none */
+static int receive_raw(PipesCommunication* this, local_id from, Message* message){
+	int res;
+
+	/* Bulk messages receive_any() put aside are older than anything still in the channel */
+	if (!stash_take(&this->bulk[from], message)){
+		return 0;
+	}
+	while (!(res = channel_receive(this, from, message))){
+		if (message->s_header.s_type != MESSAGE_FRAGMENT){
+			return 0;
+		}
+		/* Fragments wait for receive_stream() */
+		if (stash_put(&this->fragments[from], message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+			return -1;
+		}
+	}
+	return res;
+}
+
 int receive(void * self, local_id from, Message * message){
 	PipesCommunication* this = (PipesCommunication*) self;
-	
+	int res;
+
 	if (from == this->current_id){
 		return -1;
 	}
-	
-	if (read(this->pipes[GET_INDEX(from, this->current_id) * 2 + PIPE_READ_TYPE], message, sizeof(MessageHeader)) < (int)sizeof(MessageHeader)){
-		return -2;
-	}
-	
-	
-	if (read(this->pipes[GET_INDEX(from, this->current_id) * 2 + PIPE_READ_TYPE], ((char*) message) + sizeof(MessageHeader), message->s_header.s_payload_len) < 0){
-		return -3;
+	/* What receive_type() passed over is older than the bulk lane */
+	if (!mailbox_take(&this->mailboxes[from], -1, message) || !(res = receive_raw(this, from, message))){
+		wire_decode(this, from, message);
+		return 0;
 	}
-	return 0;
+	return res;
 }
 
-int receive_any(void * self, Message * message){
+/** Receive the oldest message of one type from the peer
+ *
+ * Messages of other types read on the way go to the mailboxes of the
+ * peer; receive() and receive_any() hand them out later in the order
+ * they were sent, and receive_type() for their type takes them at once.
+ *
+ * @param self		Any data structure which is useful for the student.
+ * @param from		ID of the process to receive message from
+ * @param type		MessageType to wait for
+ * @param message	Message structure allocated by the caller
+ *
+ * @return 0 on success, -2 if no message of the type has arrived yet,
+ *         RECEIVE_CLOSED if the peer closed its end, -1 on error
+ */
+int receive_type(void * self, local_id from, int16_t type, Message * message){
 	PipesCommunication* this = (PipesCommunication*) self;
+	int res;
+
+	if (from == this->current_id || type < 0 || type >= MAILBOX_TYPES){
+		return -1;
+	}
+	if (!mailbox_take(&this->mailboxes[from], type, message)){
+		wire_decode(this, from, message);
+		return 0;
+	}
+	while (!(res = receive_raw(this, from, message))){
+		if (message->s_header.s_type == type){
+			wire_decode(this, from, message);
+			return 0;
+		}
+		if (mailbox_put(&this->mailboxes[from], message)){
+			return -1;
+		}
+	}
+	return res;
+}
+
+/** Try peers marked readable, round-robin starting after the last sender
+ *
+ * A control message is returned as soon as one is found, bulk messages
+ * read on the way go to the bulk lane of their sender. Only when no ready
+ * peer has a control message the bulk lanes are served, round-robin too.
+ * Fragments are left for receive_stream().
+ *
+ * @return 0 on success, -1 if no ready peer had a message
+ */
+static int receive_ready(PipesCommunication* this, Message* message){
 	local_id i;
-	
-	for (i = 0; i < this->total_ids; i++){
-		if (i == this->current_id){
+	size_t n;
+
+	/* What receive_type() passed over is older than anything still in the channels */
+	for (n = 1; n <= this->total_ids; n++){
+		i = (this->last_msg_from + n) % this->total_ids;
+		if (!mailbox_take(&this->mailboxes[i], -1, message)){
+			this->last_msg_from = i;
+			wire_decode(this, i, message);
+			return 0;
+		}
+	}
+	for (n = 1; n <= this->total_ids; n++){
+		i = (this->last_msg_from + n) % this->total_ids;
+		if (!this->ready[i]){
 			continue;
 		}
-		
-		if (!receive(this, i, message)){
+
+		while (!channel_receive(this, i, message)){
+			if (message->s_header.s_type != MESSAGE_FRAGMENT && message_lane(message) == LANE_CONTROL){
+				this->last_msg_from = i;
+				wire_decode(this, i, message);
+				return 0;
+			}
+			if (stash_put(message->s_header.s_type == MESSAGE_FRAGMENT ? &this->fragments[i] : &this->bulk[i],
+					message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+				return -1;
+			}
+		}
+		this->ready[i] = 0;
+	}
+	for (n = 1; n <= this->total_ids; n++){
+		i = (this->last_msg_from + n) % this->total_ids;
+		if (!stash_take(&this->bulk[i], message)){
+			this->last_msg_from = i;
+			wire_decode(this, i, message);
 			return 0;
 		}
 	}
 	return -1;
 }
+
+int receive_any(void * self, Message * message){
+	PipesCommunication* this = (PipesCommunication*) self;
+	size_t round = 0;
+	int ready;
+
+	for (;;){
+		if (!receive_ready(this, message)){
+			return 0;
+		}
+		if ((ready = poller_wait(this, 0)) < 0){
+			return -1;
+		}
+		if (!ready && wait_idle(this, &round, -1, POLLIN, 0) < 0){
+			return -1;
+		}
+	}
+}
+
+/** Receive every message available now, waiting per comm->wait until there is at least one
+ *
+ * Ready peers are drained in one pass with the order of receive_any():
+ * control messages of all of them first, then bulk ones. Each peer's
+ * messages keep their order within a lane.
+ *
+ * @param self		Any data structure which is useful for the student.
+ * @param buf		Room for cap messages
+ * @param cap		Most messages to take
+ * @param from		Room for cap ids, set to the sender of each message
+ *
+ * @return count of messages put into buf, -1 if no peer can send anymore or on transport error
+ */
+int receive_many(void * self, Message * buf, size_t cap, local_id * from){
+	PipesCommunication* this = (PipesCommunication*) self;
+	size_t round = 0;
+	size_t count = 0;
+	int ready;
+
+	for (;;){
+		while (count < cap && !receive_ready(this, &buf[count])){
+			from[count++] = this->last_msg_from;
+		}
+		if (count){
+			return count;
+		}
+		if ((ready = poller_wait(this, 0)) < 0){
+			return -1;
+		}
+		if (!ready && wait_idle(this, &round, -1, POLLIN, 0) < 0){
+			return -1;
+		}
+	}
+}
+
+int flush(void * self){
+	PipesCommunication* this = (PipesCommunication*) self;
+
+	return this->transport->flush != NULL ? this->transport->flush(this) : 0;
+}
+
 int send(void * self, local_id dst, const Message * message){
 	PipesCommunication* from = (PipesCommunication*) self;
-	
+	const Message* encoded;
+	Message frame;
+	int res;
+
 	if (dst == from->current_id){
 		return -1;
 	}
-	if (write(from->pipes[GET_INDEX(dst, from->current_id) * 2 + PIPE_WRITE_TYPE], message, sizeof(MessageHeader) + message->s_header.s_payload_len) < 0){
-		return -2;
+	encoded = wire_encode(from, dst, message, &frame, 1);
+	if (!(res = from->transport->send(from, dst, encoded)) && encoded == &frame){
+		fold_settle(from, dst, &frame);
+	}
+	return res;
+}
+
+/** Bind comm to its channels of the transport opened before fork()
+ *
+ * Resets the poller, queues, wait policy and wire version to defaults, then lets the
+ * transport keep what comm->current_id uses and release the rest.
+ *
+ * @param comm		Pointer to PipesCommunication with transport, total_ids and current_id set
+ * @param channels	Result of comm->transport->open()
+ *
+ * @return -1 on transport error, 0 on success
+ */
+int transport_attach(PipesCommunication* comm, void* channels){
+	comm->ready = calloc(comm->total_ids, sizeof(char));
+	comm->closed = calloc(comm->total_ids, sizeof(char));
+	comm->bulk = calloc(comm->total_ids, sizeof(InboxStash));
+	comm->fragments = calloc(comm->total_ids, sizeof(InboxStash));
+	comm->mailboxes = calloc(comm->total_ids, sizeof(Mailbox));
+	comm->folds = calloc(comm->total_ids, sizeof(FoldQueue));
+	comm->unfolded = calloc(comm->total_ids, sizeof(InboxStash));
+	comm->fold_delay = -1;
+	comm->stream_seq = 0;
+	comm->wire = calloc(comm->total_ids, sizeof(char));
+	/* The runtime traces v1 messages only */
+	comm->wire_offer = getenv("PA_RT_DEBUG") != NULL || getenv("PA_WIRE_V1") != NULL ? WIRE_V1 : WIRE_V2;
+	comm->wide_clock = NULL;
+	comm->arena = NULL;
+	comm->wait = default_wait_policy;
+	memset(&comm->wait_stats, 0, sizeof(WaitStats));
+	timers_init(&comm->timers);
+	comm->deadline = -1;
+	comm->timer_polled = 0;
+	comm->startup_us = -1;
+	comm->poll_count = 0;
+	comm->epoll_fd = -1;
+	comm->pipes = NULL;
+	comm->seqpacket = 0;
+	comm->inbox = -1;
+	comm->stash = NULL;
+	comm->shm = NULL;
+	comm->shm_seq = 0;
+	comm->uring = NULL;
+	comm->sim = NULL;
+	comm->sim_epoch = 0;
+	comm->sim_owed = 0;
+	memset(&comm->sim_stats, 0, sizeof(SimStats));
+	comm->channels = NULL;
+	comm->inbound = NULL;
+	comm->outbound = NULL;
+	comm->out_framed = 0;
+	comm->out_high_water = OUT_HIGH_WATER;
+	memset(&comm->out_stats, 0, sizeof(OutStats));
+
+	if (channels == NULL){
+		return -1;
+	}
+	return comm->transport->attach(comm, channels);
+}
+
+/** Wait until some peer may have a message and mark it ready
+ *
+ * A peer with unfolded messages left by channel_receive() is ready at once.
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param timeout	0 to return immediately, -1 to block
+ *
+ * @return -1 if no peer can send anymore or on transport error, count of ready peers otherwise
+ */
+int poller_wait(PipesCommunication* comm, int timeout){
+	size_t i;
+	int unfolded = 0;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (comm->unfolded[i].len){
+			comm->ready[i] = 1;
+			unfolded++;
+		}
+	}
+	if (unfolded){
+		return unfolded;
 	}
+	if (!comm->poll_count){
+		return -1;
+	}
+	return comm->transport->poll(comm, timeout);
+}
+
+/** Write out everything send() accepted and release the channels of comm */
+void transport_detach(PipesCommunication* comm){
+	size_t i;
+
+	fold_flush(comm);
+	if (comm->transport->close != NULL){
+		comm->transport->close(comm);
+	}
+	for (i = 0; i < comm->total_ids; i++){
+		size_t type;
+
+		free(comm->bulk[i].data);
+		free(comm->fragments[i].data);
+		free(comm->unfolded[i].data);
+		for (type = 0; type <= MAILBOX_TYPES; type++){
+			free(comm->mailboxes[i].types[type].data);
+		}
+	}
+	free(comm->bulk);
+	free(comm->fragments);
+	free(comm->mailboxes);
+	free(comm->folds);
+	free(comm->unfolded);
+	free(comm->wire);
+	free(comm->ready);
+	free(comm->closed);
+	timers_destroy(&comm->timers);
+}
+
+static void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/** Spend one idle round of a blocking call according to comm->wait
+ *
+ * The first spin_limit rounds busy-wait, the next yield_limit rounds give
+ * up the CPU and later rounds park in the kernel until a sender signals.
+ * Due timers run and queued sends are flushed first, parking also wakes
+ * up to write the queues whose pipes were full, for the next timer and
+ * at the deadline of receive_timed().
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param round		Idle rounds already spent by the caller, incremented here
+ * @param peer		Peer the caller waits for, -1 for any peer, own id for room in the broadcast ring
+ * @param events	POLLIN to wait for a message, POLLOUT to wait for room to send
+ * @param len		Bytes the caller wants to send, POLLOUT only
+ *
+ * @return -1 if the awaited peer can never make progress, 0 otherwise
+ */
+int wait_idle(PipesCommunication* comm, size_t* round, local_id peer, short events, size_t len){
+	size_t phase = (*round)++;
+
+	timers_fire(&comm->timers);
+	/* Peers may be waiting for what is still queued */
+	flush(comm);
+
+	if (phase < comm->wait.spin_limit){
+		comm->wait_stats.spins++;
+		cpu_relax();
+		return 0;
+	}
+	if (phase < comm->wait.spin_limit + comm->wait.yield_limit || !comm->wait.park){
+		comm->wait_stats.yields++;
+		sched_yield();
+		return 0;
+	}
+	comm->wait_stats.parks++;
+	if (peer < 0){
+		return poller_wait(comm, -1) < 0 ? -1 : 0;
+	}
+	return comm->transport->park(comm, peer, events, len);
+}
+
+/* When the blocking call of comm has to wake up by itself, -1 if only a peer can wake it */
+static int64_t wake_at(PipesCommunication* comm){
+	int64_t next = timers_next(&comm->timers);
+
+	if (comm->deadline >= 0 && (next < 0 || comm->deadline < next)){
+		next = comm->deadline;
+	}
+	return next;
+}
+
+/** Arm the timerfd of comm for the next timer or deadline, for transports sleeping in poll()
+ *
+ * @return fd to watch along with the channels, -1 if nothing but a peer can end the sleep
+ */
+int wake_fd(PipesCommunication* comm){
+	return timers_arm(&comm->timers, wake_at(comm));
+}
+
+/**
+ * @return microseconds a transport sleeping on a futex may sleep, -1 for no limit
+ */
+long wake_in_us(PipesCommunication* comm){
+	int64_t at = wake_at(comm);
+
+	if (at < 0){
+		return -1;
+	}
+	at -= monotonic_us();
+	return at > 0 ? at : 0;
+}
+
+/** Receive a message from the process specified by id, waiting per comm->wait
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param from		ID of the process to receive message from
+ * @param message	Message structure allocated by the caller
+ *
+ * @return -1 if the peer can never send the message, 0 on success
+ */
+int receive_blocking(PipesCommunication* comm, local_id from, Message* message){
+	size_t round = 0;
+	int res;
+
+	if (from == comm->current_id){
+		return -1;
+	}
+	while ((res = receive(comm, from, message))){
+		if (res == RECEIVE_CLOSED || wait_idle(comm, &round, from, POLLIN, 0) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** receive_type() that waits per comm->wait until a message of the type arrives
+ *
+ * @return -1 if the peer closed its end before sending one, 0 on success
+ */
+int receive_type_blocking(PipesCommunication* comm, local_id from, int16_t type, Message* message){
+	size_t round = 0;
+	int res;
+
+	while ((res = receive_type(comm, from, type, message))){
+		if (res == RECEIVE_CLOSED || res == -1 || wait_idle(comm, &round, from, POLLIN, 0) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** receive_blocking() that gives up at a deadline
+ *
+ * Parking sleeps no longer than until the deadline, timers of comm keep
+ * running meanwhile.
+ *
+ * @param self		Any data structure which is useful for the student.
+ * @param from		ID of the process to receive message from
+ * @param message	Message structure allocated by the caller
+ * @param deadline	monotonic_us() to give up at, -1 to wait as long as it takes
+ *
+ * @return 0 on success, RECEIVE_TIMEOUT if nothing arrived by the deadline,
+ *         -1 if the peer can never send the message
+ */
+int receive_timed(void * self, local_id from, Message * message, int64_t deadline){
+	PipesCommunication* comm = (PipesCommunication*) self;
+	int64_t outer = comm->deadline;
+	size_t round = 0;
+	int res;
+
+	if (from == comm->current_id){
+		return -1;
+	}
+	comm->deadline = deadline;
+	while ((res = receive(comm, from, message))){
+		if (res == RECEIVE_CLOSED || res == -1){
+			res = -1;
+			break;
+		}
+		if (deadline >= 0 && monotonic_us() >= deadline){
+			res = RECEIVE_TIMEOUT;
+			break;
+		}
+		if (wait_idle(comm, &round, from, POLLIN, 0) < 0){
+			res = -1;
+			break;
+		}
+	}
+	comm->deadline = outer;
+	return res;
+}
+
+/** receive_any() that gives up at a deadline
+ *
+ * @param deadline	monotonic_us() to give up at, -1 to wait as long as it takes
+ *
+ * @return 0 on success, RECEIVE_TIMEOUT if nothing arrived by the deadline,
+ *         -1 if no peer can send anymore or on transport error
+ */
+int receive_any_timed(void * self, Message * message, int64_t deadline){
+	PipesCommunication* this = (PipesCommunication*) self;
+	int64_t outer = this->deadline;
+	size_t round = 0;
+	int res, ready;
+
+	this->deadline = deadline;
+	while ((res = receive_ready(this, message))){
+		if ((ready = poller_wait(this, 0)) < 0){
+			break;
+		}
+		if (ready){
+			continue;
+		}
+		if (deadline >= 0 && monotonic_us() >= deadline){
+			res = RECEIVE_TIMEOUT;
+			break;
+		}
+		if (wait_idle(this, &round, -1, POLLIN, 0) < 0){
+			break;
+		}
+	}
+	this->deadline = outer;
+	return res;
+}
+
+/** Send a message to the process specified by id, waiting per comm->wait while its channel is full
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param dst		ID of recepient
+ * @param message	Message to send
+ *
+ * @return -1 if the peer can never accept the message or on error, 0 on success
+ */
+int send_blocking(PipesCommunication* comm, local_id dst, const Message* message){
+	size_t round = 0;
+	int res;
+
+	if (dst == comm->current_id){
+		return -1;
+	}
+	while ((res = send(comm, dst, message))){
+		/* Only a full channel is worth waiting for */
+		if (res != -2 || wait_idle(comm, &round, dst, POLLOUT, sizeof(MessageHeader) + message->s_header.s_payload_len) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** send_batch() that waits by wait policy for room until every item is sent
+ *
+ * @return -1 on error, 0 on success
+ */
+int send_batch_blocking(PipesCommunication* comm, const SendItem* items, size_t n){
+	size_t round = 0;
+	int sent;
+
+	while (n){
+		if ((sent = send_batch(comm, items, n)) < 0){
+			return -1;
+		}
+		if (sent){
+			items += sent;
+			n -= sent;
+			round = 0;
+		}
+		else if (wait_idle(comm, &round, items->dst, POLLOUT, sizeof(MessageHeader) + items->message->s_header.s_payload_len) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Owe the message of item to its peer, -1 if it has to go out on its own now */
+static int fold_put(PipesCommunication* comm, const SendItem* item){
+	FoldQueue* fold = &comm->folds[item->dst];
+	const MessageHeader* header = &item->message->s_header;
+
+	if (comm->fold_delay < 0 || item->dst == comm->current_id || header->s_payload_len
+			|| header->s_type < 0 || header->s_type > UINT8_MAX || wire_version(comm, item->dst) < WIRE_V2
+			|| fold->count >= FOLD_MAX || (fold->count && fold->header.s_type != header->s_type)){
+		return -1;
+	}
+	fold->header = *header;
+	fold->count++;
 	return 0;
 }
+
+/** Send the messages of items, letting empty ones ride on later messages to their peers
+ *
+ * Once fold_start() ran, an empty message is owed to its peer instead of
+ * sent: the next v2 message to the peer counts it in its WireTrailer, and
+ * the receiver hands it out ahead of the carrier.
+ * What nothing carries goes out when the fold timer comes, the owed
+ * messages of a peer as one message carrying the rest. Messages with a
+ * payload, to v1 peers or of another type than what the peer is owed
+ * already go out at once with send_batch_blocking().
+ *
+ * @return -1 on error, 0 on success
+ */
+int send_folded(PipesCommunication* comm, const SendItem* items, size_t n){
+	SendItem rest[SEND_BATCH];
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++){
+		if (fold_put(comm, &items[i])){
+			rest[count++] = items[i];
+		}
+		if (count == SEND_BATCH || (count && i + 1 == n)){
+			if (send_batch_blocking(comm, rest, count)){
+				return -1;
+			}
+			count = 0;
+		}
+	}
+	return 0;
+}
+
+/** Send everything owed to the peers, one message per peer carrying the rest
+ *
+ * What is owed to a peer that can never take it is dropped.
+ *
+ * @return count of messages sent
+ */
+int fold_flush(PipesCommunication* comm){
+	local_id i;
+	int sent = 0;
+
+	for (i = 0; i < comm->total_ids; i++){
+		FoldQueue* fold = &comm->folds[i];
+		Message message;
+
+		if (!fold->count){
+			continue;
+		}
+		/* The message that goes out is one of the owed ones */
+		message.s_header = fold->header;
+		fold->count--;
+		if (send_blocking(comm, i, &message)){
+			fold->count = 0;
+			continue;
+		}
+		sent++;
+	}
+	return sent;
+}
+
+/* Messages owed to all peers together */
+size_t fold_owed(PipesCommunication* comm){
+	size_t owed = 0;
+	local_id i;
+
+	for (i = 0; i < comm->total_ids; i++){
+		owed += comm->folds[i].count;
+	}
+	return owed;
+}
+
+static void fold_tick(void* arg){
+	fold_flush(arg);
+}
+
+/** Let send_folded() owe empty messages to peers for up to delay_us microseconds
+ *
+ * The timer runs while the process waits, a process busy with its own
+ * work may owe them longer unless it sends to the peer meanwhile. A
+ * simulation has no timer, sim_wait() sends them in virtual time.
+ *
+ * @return -1 if delay_us is negative or no timer is left, 0 on success
+ */
+int fold_start(PipesCommunication* comm, long delay_us){
+	if (delay_us < 0){
+		return -1;
+	}
+	/* The wall clock would make two runs with the same seed differ */
+	if (comm->sim == NULL && timer_start(&comm->timers, delay_us ? delay_us : 1, fold_tick, comm) < 0){
+		return -1;
+	}
+	comm->fold_delay = delay_us;
+	return 0;
+}
+
+void message_stream_init(MessageStream* stream){
+	stream->started = 0;
+	stream->total = 0;
+	stream->offset = 0;
+	stream->fragment_pos = 0;
+	stream->fragment_end = 0;
+}
+
+/** Send a message of any length as fragments of at most FRAGMENT_CHUNK bytes each
+ *
+ * The fragments go out one after another without waiting for the
+ * receiver, which reads them with receive_stream(). Messages of other
+ * peers are not held up by them: receive() and receive_any() set
+ * fragments aside and bulk fragments never overtake control messages.
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param dst		ID of recepient
+ * @param header	Magic, type and time of the message, s_payload_len is ignored
+ * @param data		Bytes of the message
+ * @param len		Length of data
+ *
+ * @return -1 if the peer can never accept the message, 0 on success
+ */
+int send_stream(PipesCommunication* comm, local_id dst, const MessageHeader* header, const void* data, size_t len){
+	Message message;
+	FragmentHeader fragment;
+	size_t offset = 0;
+
+	message.s_header = *header;
+	message.s_header.s_type = MESSAGE_FRAGMENT;
+	fragment.s_id = comm->stream_seq++;
+	fragment.s_total = len;
+	fragment.s_type = header->s_type;
+	fragment.s_reserved = 0;
+	do{
+		size_t chunk = len - offset < FRAGMENT_CHUNK ? len - offset : FRAGMENT_CHUNK;
+
+		fragment.s_offset = offset;
+		memcpy(message.s_payload, &fragment, sizeof(FragmentHeader));
+		memcpy(message.s_payload + sizeof(FragmentHeader), (const char*) data + offset, chunk);
+		message.s_header.s_payload_len = sizeof(FragmentHeader) + chunk;
+		if (send_blocking(comm, dst, &message)){
+			return -1;
+		}
+		offset += chunk;
+	} while (offset < len);
+	return 0;
+}
+
+/** Move one message of the peer off its channel, fragments to the fragment stash and others to the bulk lane
+ *
+ * @return receive() result of the transport, -1 if memory is exhausted
+ */
+static int stream_pull(PipesCommunication* comm, local_id from){
+	Message message;
+	int res;
+
+	if ((res = channel_receive(comm, from, &message))){
+		return res;
+	}
+	if (stash_put(message.s_header.s_type == MESSAGE_FRAGMENT ? &comm->fragments[from] : &comm->bulk[from],
+			&message, sizeof(MessageHeader) + message.s_header.s_payload_len)){
+		return -1;
+	}
+	return 0;
+}
+
+/* Take the next fragment of the stream, -1 if it does not continue the stream */
+static int stream_next(PipesCommunication* comm, local_id from, MessageStream* stream){
+	FragmentHeader fragment;
+
+	wire_decode(comm, from, &stream->fragment);
+	if (stream->fragment.s_header.s_payload_len < sizeof(FragmentHeader)){
+		return -1;
+	}
+	memcpy(&fragment, stream->fragment.s_payload, sizeof(FragmentHeader));
+	if (!stream->started){
+		stream->started = 1;
+		stream->header = stream->fragment.s_header;
+		stream->header.s_type = fragment.s_type;
+		stream->time = message_time(&stream->fragment);
+		stream->id = fragment.s_id;
+		stream->total = fragment.s_total;
+	}
+	if (fragment.s_id != stream->id || fragment.s_offset != stream->offset || fragment.s_total != stream->total
+			|| stream->offset + stream->fragment.s_header.s_payload_len - sizeof(FragmentHeader) > stream->total){
+		return -1;
+	}
+	stream->fragment_pos = sizeof(FragmentHeader);
+	stream->fragment_end = stream->fragment.s_header.s_payload_len;
+	return 0;
+}
+
+/** Read the next piece of a long message from the peer, waiting per comm->wait until its fragment arrives
+ *
+ * Only the fragment being read is buffered, so the message can be
+ * consumed as it arrives. Messages that are no fragments and arrive
+ * meanwhile stay for receive() and receive_any().
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param from		ID of the sender
+ * @param stream	Stream set up by message_stream_init(), header, time and total are known after the first call
+ * @param buf		Buffer for the next piece
+ * @param cap		Size of buf
+ *
+ * @return bytes put into buf, 0 once the whole message was read, -1 if the peer can never send the rest
+ */
+int receive_stream(PipesCommunication* comm, local_id from, MessageStream* stream, void* buf, size_t cap){
+	size_t round = 0;
+	size_t len;
+	int res;
+
+	if (from == comm->current_id){
+		return -1;
+	}
+	if (stream->started && stream->offset == stream->total){
+		return 0;
+	}
+	while (stream->fragment_pos == stream->fragment_end){
+		if (!stash_take(&comm->fragments[from], &stream->fragment)){
+			if (stream_next(comm, from, stream)){
+				return -1;
+			}
+			if (stream->offset == stream->total){
+				return 0;
+			}
+			continue;
+		}
+		if ((res = stream_pull(comm, from)) && (res == RECEIVE_CLOSED || res == -1 || wait_idle(comm, &round, from, POLLIN, 0) < 0)){
+			return -1;
+		}
+	}
+	len = stream->fragment_end - stream->fragment_pos < cap ? stream->fragment_end - stream->fragment_pos : cap;
+	memcpy(buf, stream->fragment.s_payload + stream->fragment_pos, len);
+	stream->fragment_pos += len;
+	stream->offset += len;
+	return len;
+}
+
+/** Send a payload placed in comm->arena as a small handle instead of copying it
+ *
+ * The receiver reads the payload in place through message_payload() and
+ * gives it back with message_payload_release(), the sender keeps its own
+ * reference. A payload outside the arena, as with processes launched on
+ * their own, goes out inline.
+ *
+ * @param comm		Pointer to PipesCommunication
+ * @param dst		ID of recepient
+ * @param header	Magic, type and time of the message, s_payload_len is ignored
+ * @param data		Payload, from shm_arena_alloc() on comm->arena to be handed over in place
+ * @param len		Length of data
+ *
+ * @return -1 if the peer can never accept the message or it is too long to go inline, 0 on success
+ */
+int send_handle(PipesCommunication* comm, local_id dst, const MessageHeader* header, void* data, size_t len){
+	Message message;
+	ShmHandle handle;
+
+	message.s_header = *header;
+	if (!shm_arena_contains(comm->arena, data)){
+		if (len > MAX_PAYLOAD_LEN){
+			return -1;
+		}
+		message.s_header.s_payload_len = len;
+		memcpy(message.s_payload, data, len);
+		return send_blocking(comm, dst, &message);
+	}
+	handle.s_offset = shm_arena_offset(comm->arena, data);
+	handle.s_len = len;
+	handle.s_type = header->s_type;
+	handle.s_reserved = 0;
+	message.s_header.s_type = MESSAGE_HANDLE;
+	message.s_header.s_payload_len = sizeof(ShmHandle);
+	memcpy(message.s_payload, &handle, sizeof(ShmHandle));
+
+	shm_arena_retain(comm->arena, data);
+	if (send_blocking(comm, dst, &message)){
+		shm_arena_release(comm->arena, data);
+		return -1;
+	}
+	return 0;
+}
+
+/** Find the payload of a received message, in the arena for a handle
+ *
+ * @param len		Set to the length of the payload
+ * @param type		Set to the type of the payload
+ *
+ * @return the payload, NULL for a handle without an arena to read it in
+ */
+const void* message_payload(PipesCommunication* comm, const Message* message, size_t* len, int16_t* type){
+	ShmHandle handle;
+
+	if (message->s_header.s_type != MESSAGE_HANDLE){
+		*len = message->s_header.s_payload_len;
+		*type = message->s_header.s_type;
+		return message->s_payload;
+	}
+	memcpy(&handle, message->s_payload, sizeof(ShmHandle));
+	if (comm->arena == NULL){
+		return NULL;
+	}
+	*len = handle.s_len;
+	*type = handle.s_type;
+	return shm_arena_data(comm->arena, handle.s_offset);
+}
+
+/* Give back the payload of a handle once it is read, nothing to do for other messages */
+void message_payload_release(PipesCommunication* comm, const Message* message){
+	ShmHandle handle;
+
+	if (message->s_header.s_type == MESSAGE_HANDLE && comm->arena != NULL){
+		memcpy(&handle, message->s_payload, sizeof(ShmHandle));
+		shm_arena_release(comm->arena, shm_arena_data(comm->arena, handle.s_offset));
+	}
+}
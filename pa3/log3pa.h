@@ -7,10 +7,14 @@
 #include "ipc.h"
 
 
-void log_init();
+void log_init(const char* mode);
 void log_destroy();
 
 void log_pipes(PipesCommunication* comm);
+void log_wait_stats(PipesCommunication* comm);
+void log_out_stats(PipesCommunication* comm);
+void log_startup_stats(PipesCommunication* comm);
+void log_sim_stats(PipesCommunication* comm);
 
 void log_started(local_id id, balance_t balance);
 void log_received_all_started(local_id id);
@@ -4,47 +4,68 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <getopt.h>
+#include <pthread.h>
 #include "log3pa.h"
 #include "communication.h"
 #include "banking.h"
 #include "ltime.h"
 #include "common.h"
 #include "pa2345.h"
-#include <fcntl.h>
+#include "spawn.h"
+#include "fiber.h"
 
 
-int set_nonblock(int pipe_id);
-
 /* lamport_time operation*/
-static timestamp_t lamport_time = 0;
+/* Times of one participant: its Lamport clock and the end of its balance history */
+typedef struct{
+	wide_timestamp_t lamport_time;	/* messages and history carry its low bits */
+	timestamp_t prev_time;
+} ParticipantClock;
+
+/* Every participant has its own clock, also when participants are threads */
+static __thread ParticipantClock thread_clock;
+
+/* A fiber may resume on another thread, it carries its clock as its local value */
+static ParticipantClock* participant_clock(){
+	ParticipantClock* clock = fiber_local();
+
+	return clock != NULL ? clock : &thread_clock;
+}
 
 timestamp_t increment_lamport_time(){
-	return ++lamport_time;
+	return ++participant_clock()->lamport_time;
 }
 
-timestamp_t set_lamport_time(timestamp_t new_lamport_time){
-	if (lamport_time < new_lamport_time){
-		lamport_time = new_lamport_time;
+timestamp_t set_lamport_time(wide_timestamp_t new_lamport_time){
+	ParticipantClock* clock = participant_clock();
+
+	if (clock->lamport_time < new_lamport_time){
+		clock->lamport_time = new_lamport_time;
 	}
-	return lamport_time;
+	return clock->lamport_time;
 }
 
 timestamp_t set_lamport_time_from_msg(Message* msg){
-	set_lamport_time(msg->s_header.s_local_time);
+	set_lamport_time(message_time(msg));
 	return increment_lamport_time();
 }
 
 timestamp_t get_lamport_time(){
-	return lamport_time;
+	return participant_clock()->lamport_time;
+}
+
+wide_timestamp_t get_wide_lamport_time(){
+	return participant_clock()->lamport_time;
 }
 
 
 FILE* pipes_log_f;
 FILE* events_log_f;
 
-void log_init(){
-	pipes_log_f = fopen(pipes_log, "w");
-	events_log_f = fopen(events_log, "w");
+void log_init(const char* mode){
+	pipes_log_f = fopen(pipes_log, mode);
+	events_log_f = fopen(events_log, mode);
 }
 
 void log_started(local_id id, balance_t balance){
@@ -77,6 +98,28 @@ void log_transfer_in(local_id from, local_id dst, balance_t amount){
 	fprintf(events_log_f, log_transfer_in_fmt, get_lamport_time(), dst, amount, from);
 }
 
+void log_wait_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "process %d waited: %zu spins, %zu yields, %zu parks\n", pipes_comm->current_id,
+		pipes_comm->wait_stats.spins, pipes_comm->wait_stats.yields, pipes_comm->wait_stats.parks);
+}
+void log_startup_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "process %d received all STARTED %ld us after startup\n", pipes_comm->current_id, pipes_comm->startup_us);
+}
+
+void log_sim_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "process %d done at tick %ld: %zu messages sent, %zu received, %.1f ticks in flight on average\n", pipes_comm->current_id,
+		sim_time(pipes_comm), pipes_comm->sim_stats.sent, pipes_comm->sim_stats.received,
+		pipes_comm->sim_stats.received ? (double) pipes_comm->sim_stats.in_flight / pipes_comm->sim_stats.received : 0.0);
+	if (pipes_comm->transfer_count){
+		fprintf(stderr, "process %d made %zu transfers: %.1f ticks from TRANSFER to ACK on average\n", pipes_comm->current_id,
+			pipes_comm->transfer_count, (double) pipes_comm->transfer_time / pipes_comm->transfer_count);
+	}
+}
+void log_out_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "process %d sent: %zu writes, %zu partial, %zu full pipe, %zu throttled, %zu bytes queued at most\n", pipes_comm->current_id,
+		pipes_comm->out_stats.writes, pipes_comm->out_stats.partial, pipes_comm->out_stats.full,
+		pipes_comm->out_stats.throttled, pipes_comm->out_stats.max_queued);
+}
 void log_destroy(){
 	fclose(pipes_log_f);
     fclose(events_log_f);
@@ -85,7 +128,12 @@ void log_destroy(){
 void log_pipes(PipesCommunication* pipes_comm){
 	size_t i;
 	
-	fprintf(pipes_log_f, "process %d pipes:\n", pipes_comm->current_id);
+	if (pipes_comm->pipes == NULL){
+		fprintf(pipes_log_f, "process %d uses %s transport\n", pipes_comm->current_id, pipes_comm->transport->name);
+		return;
+	}
+	
+	fprintf(pipes_log_f, "process %d %s:\n", pipes_comm->current_id, pipes_comm->seqpacket ? "sockets" : "pipes");
 	
 	for (i = 0; i < pipes_comm->total_ids; i++){
 		if (i == pipes_comm->current_id){
@@ -99,7 +147,7 @@ void log_pipes(PipesCommunication* pipes_comm){
 }
 
 void update_history(BalanceState* state, BalanceHistory* history, balance_t amount, timestamp_t timestamp_msg, char inc, char fix){
-	static timestamp_t prev_time = 0;
+	timestamp_t* prev_time = &participant_clock()->prev_time;
     //timestamp_t curr_time = get_physical_time();
    timestamp_t curr_time = get_lamport_time() < timestamp_msg ? timestamp_msg : get_lamport_time();
 	timestamp_t i;
@@ -112,7 +160,7 @@ void update_history(BalanceState* state, BalanceHistory* history, balance_t amou
 	}
     history->s_history_len = curr_time + 1;
 	
-	for (i = prev_time; i < curr_time; i++){
+	for (i = *prev_time; i < curr_time; i++){
 		state->s_time = i;
 		history->s_history[i] = *state;
 	}
@@ -121,7 +169,7 @@ void update_history(BalanceState* state, BalanceHistory* history, balance_t amou
 	      history->s_history[i].s_balance_pending_in += amount;
 		}
 	}
-	prev_time = curr_time;
+	*prev_time = curr_time;
 	state->s_time = curr_time;
 	state->s_balance += amount;
 	history->s_history[curr_time] = *state;
@@ -167,17 +215,20 @@ int do_parent_work(PipesCommunication* pipes_comm){
     receive_all_msgs(pipes_comm, DONE);
 	
 	for (i = 1; i < pipes_comm->total_ids; i++){
-		BalanceHistory balance_history;
+		const void* history;
+		size_t len;
+		int16_t type;
 		Message msg;
 		
-		while(receive(pipes_comm, i, &msg));
+		receive_blocking(pipes_comm, i, &msg);
 		
-		if (msg.s_header.s_type != BALANCE_HISTORY){
+		/* A history built in the arena is read in place, the only copy is into all_history */
+		if ((history = message_payload(pipes_comm, &msg, &len, &type)) == NULL || type != BALANCE_HISTORY || len > sizeof(BalanceHistory)){
 			return -1;
 		}
 		
-		memcpy((void*)&balance_history, msg.s_payload, sizeof(char) * msg.s_header.s_payload_len);
-		all_history.s_history[i - 1] = balance_history;
+		memcpy(&all_history.s_history[i - 1], history, len);
+		message_payload_release(pipes_comm, &msg);
 	}
 	
 	print_history(&all_history);
@@ -186,17 +237,25 @@ int do_parent_work(PipesCommunication* pipes_comm){
 
 int do_child_work(PipesCommunication* pipes_comm){
 	BalanceState balance_state;
-        BalanceHistory balance_history;
+        BalanceHistory own_history;
+	BalanceHistory* balance_history = NULL;
 	size_t done_left = pipes_comm->total_ids - 2;
 	int not_stopped = 1;
 
-    	balance_history.s_id = pipes_comm->current_id;
+	/* Built where the parent reads it, if the processes share an arena */
+	if (pipes_comm->arena != NULL){
+		balance_history = shm_arena_alloc(pipes_comm->arena, sizeof(BalanceHistory));
+	}
+	if (balance_history == NULL){
+		balance_history = &own_history;
+	}
+    	balance_history->s_id = pipes_comm->current_id;
 	
 	balance_state.s_balance = pipes_comm->balance;
     	balance_state.s_balance_pending_in = 0;
     	balance_state.s_time = 0;
 	
-	update_history(&balance_state, &balance_history, 0, 0, 0, 0);
+	update_history(&balance_state, balance_history, 0, 0, 0, 0);
 	
 	increment_lamport_time();   //lamport_time
 	send_all_proc_event_msg(pipes_comm, STARTED); //send & receive STARTED message 
@@ -204,31 +263,41 @@ int do_child_work(PipesCommunication* pipes_comm){
         receive_all_msgs(pipes_comm, STARTED);
 	
 	while(done_left || not_stopped){
-		Message msg;
+		Message messages[RECEIVE_BATCH];
+		local_id from[RECEIVE_BATCH];
+		int count, k;
 		
-        while (receive_any(pipes_comm, &msg));
+		/* Everything already arrived is handled in one pass, in arrival order */
+        while ((count = receive_many(pipes_comm, messages, RECEIVE_BATCH, from)) < 0);
 		
-		if (msg.s_header.s_type == TRANSFER){
-			do_transfer(pipes_comm, &msg, &balance_state, &balance_history);
-		}
-		else if (msg.s_header.s_type == STOP){
-	   update_history(&balance_state, &balance_history, 0, msg.s_header.s_local_time, 1, 0);
-			send_all_proc_event_msg(pipes_comm, DONE);
-			not_stopped = 0;
-		}
-		else if (msg.s_header.s_type == DONE){
-           update_history(&balance_state, &balance_history, 0, msg.s_header.s_local_time, 1, 0); 
-			done_left--;
-		}
-		else{
-			return -1;
+		for (k = 0; k < count; k++){
+			Message* msg = &messages[k];
+			
+			if (msg->s_header.s_type == TRANSFER){
+				do_transfer(pipes_comm, msg, &balance_state, balance_history);
+			}
+			else if (msg->s_header.s_type == STOP){
+	   update_history(&balance_state, balance_history, 0, msg->s_header.s_local_time, 1, 0);
+				send_all_proc_event_msg(pipes_comm, DONE);
+				not_stopped = 0;
+			}
+			else if (msg->s_header.s_type == DONE){
+           update_history(&balance_state, balance_history, 0, msg->s_header.s_local_time, 1, 0); 
+				done_left--;
+			}
+			else{
+				return -1;
+			}
 		}
 	}
 	
 	log_received_all_done(pipes_comm->current_id);
 	
-	update_history(&balance_state, &balance_history, 0, 0, 1, 0);
-	send_balance_history(pipes_comm, PARENT_ID, &balance_history);
+	update_history(&balance_state, balance_history, 0, 0, 1, 0);
+	send_balance_history(pipes_comm, PARENT_ID, balance_history);
+	if (balance_history != &own_history){
+		shm_arena_release(pipes_comm->arena, balance_history);
+	}
 	return 0;
 }
 
@@ -237,145 +306,373 @@ int do_child_work(PipesCommunication* pipes_comm){
 
 
 
-int get_proc_count(int argc, char** argv){
-	int proc_count;
-	if (!strcmp(argv[1], "-p") && (proc_count = atoi(argv[2])) == (argc - 3)){
-		return proc_count;
+/** Parse -p X [options] followed by X balances
+ *
+ * @return -1 on invalid arguments, index of the first balance in argv otherwise
+ */
+int get_agrs(int argc, char** argv, int* processes, const Transport** transport, int* uring, WaitPolicy* wait, size_t* high_water, int* stats, int* fork_tree, int* threads, int* fibers, local_id* node_id, const char** peers){
+	int res;
+	int sim = 0;
+	const char* latency = NULL;
+	unsigned long seed = 1;
+	const struct option long_options[] = {
+        {"transport", required_argument, NULL, 't'},
+        {"id", required_argument, NULL, 'i'},
+        {"peers", required_argument, NULL, 'P'},
+        {"uring", no_argument, uring, 1},
+        {"spin", required_argument, NULL, 's'},
+        {"yield", required_argument, NULL, 'y'},
+        {"no-park", no_argument, NULL, 'n'},
+        {"high-water", required_argument, NULL, 'w'},
+        {"stats", no_argument, stats, 1},
+        {"fork-tree", no_argument, fork_tree, 1},
+        {"threads", no_argument, threads, 1},
+        {"fibers", required_argument, NULL, 'f'},
+        {"sim", no_argument, &sim, 1},
+        {"seed", required_argument, NULL, 'S'},
+        {"latency", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0}
+    };
+	
+	*processes = -1;
+	*transport = NULL;
+	*node_id = -1;
+	*peers = NULL;
+	*uring = 0;
+	*stats = 0;
+	*fork_tree = 0;
+	*threads = 0;
+	*fibers = 0;
+	*wait = default_wait_policy;
+	*high_water = OUT_HIGH_WATER;
+	
+	while ((res = getopt_long(argc, argv, "p:", long_options, NULL)) != -1){
+		if (res == 'p'){
+			*processes = atoi(optarg);
+		}
+		else if (res == 't'){
+			if ((*transport = transport_find(optarg)) == NULL){
+				return -1;
+			}
+		}
+		else if (res == 'i'){
+			*node_id = atoi(optarg);
+		}
+		else if (res == 'P'){
+			*peers = optarg;
+		}
+		else if (res == 's'){
+			wait->spin_limit = atoi(optarg);
+		}
+		else if (res == 'y'){
+			wait->yield_limit = atoi(optarg);
+		}
+		else if (res == 'n'){
+			wait->park = 0;
+		}
+		else if (res == 'w'){
+			*high_water = atol(optarg);
+		}
+		else if (res == 'f'){
+			if ((*fibers = atoi(optarg)) <= 0){
+				return -1;
+			}
+		}
+		else if (res == 'S'){
+			seed = strtoul(optarg, NULL, 10);
+		}
+		else if (res == 'L'){
+			latency = optarg;
+		}
+		else if (res == '?'){
+			return -1;
+		}
 	}
-	return -1;
+	/* Threads and fibers talk through rings in the memory they share, neither apart nor over another transport */
+	if (*threads || *fibers){
+		if (*transport != NULL || *peers != NULL || (*threads && *fibers)){
+			return -1;
+		}
+		*transport = *threads ? &thread_transport : &fiber_transport;
+	}
+	/* A simulation runs every participant as a fiber of one worker, in virtual time */
+	if (sim){
+		if (*transport != NULL || *peers != NULL || sim_transport_configure(latency, seed)){
+			return -1;
+		}
+		*transport = &sim_transport;
+		*fibers = 1;
+	}
+	else if (latency != NULL){
+		return -1;
+	}
+	if (*transport == NULL){
+		*transport = *peers != NULL ? &tcp_transport : &pipe_transport;
+	}
+	if (*processes <= 0 || *processes != argc - optind){
+		return -1;
+	}
+	/* A node launched on its own needs its id and the rendezvous file */
+	if ((*peers != NULL) != (*node_id >= 0) || *node_id > *processes){
+		return -1;
+	}
+	return optind;
 }
 
 
-balance_t get_proc_balance(local_id proc_id, char** argv){
-	return atoi(argv[proc_id + 2]);
+balance_t get_proc_balance(local_id proc_id, char** balances){
+	return proc_id == PARENT_ID ? 0 : atoi(balances[proc_id - 1]);
 }
-int main(int argc, char** argv){
-	size_t i;
-	int proc_count;
-	int* pipes;
-	pid_t* children;
-	pid_t fork_id;
-	local_id current_proc_id;
-	PipesCommunication* pipes_comm;
+
+
+/* What one participant of the run needs, in its own process or thread */
+typedef struct{
+	const Transport* transport;
+	void* channels;
+	size_t proc_count;
+	local_id id;
+	char** balances;
+	int uring;
+	int stats;
+	WaitPolicy wait;
+	size_t high_water;
+	ParticipantClock clock;	/* times of a fiber, processes and threads keep their own */
+	ShmArena* arena;	/* where children hand their histories over, NULL for nodes launched on their own */
+} Participant;
+
+/** Run the participant with its own communication and Lamport clock
+ *
+ * @param participant	Settings of the participant, id set
+ *
+ * @return 0 when the participant is done
+ */
+int run_participant(Participant* participant){
+	PipesCommunication* pipes_comm = communication_init(participant->transport, participant->channels, participant->proc_count, participant->id, 		    get_proc_balance(participant->id, participant->balances));
+	
+	pipes_comm->wait = participant->wait;
+	pipes_comm->out_high_water = participant->high_water;
+	pipes_comm->arena = participant->arena;
+	if (participant->uring && uring_start(pipes_comm) < 0){
+		fprintf(stderr, "io_uring is not available for this transport, using plain reads and writes\n");
+	}
+	log_pipes(pipes_comm);
 	
 	
-	if (argc < 4 || (proc_count = get_proc_count(argc, argv)) == -1){
-		fprintf(stderr, "Usage: %s -p X y1 y2 ... yX\n", argv[0]);
-		return -1;
+	if (participant->id == PARENT_ID){
+		do_parent_work(pipes_comm);
+	}
+	else{
+		do_child_work(pipes_comm);
 	}
 	
-	log_init(); // Initialize log files 
 	
-	children = malloc(sizeof(pid_t) * proc_count);
+	if (participant->stats){
+		log_wait_stats(pipes_comm);
+		log_out_stats(pipes_comm);
+		log_startup_stats(pipes_comm);
+		if (pipes_comm->sim != NULL){
+			log_sim_stats(pipes_comm);
+		}
+	}
 	
-	pipes = pipes_init(proc_count + 1); // open pipes 
+	communication_destroy(pipes_comm);
+	return 0;
+}
+
+/* Every participant of the run with the settings of config and its own id */
+static Participant* participants_init(const Participant* config){
+	Participant* participants = malloc(sizeof(Participant) * config->proc_count);
+	size_t i;
 	
-	for (i = 0; i < proc_count; i++){
-		fork_id = fork();
-		if (fork_id < 0){
-			return -2;
-		}
-		else if (!fork_id){
-			free(children);
-			break;
+	for (i = 0; i < config->proc_count; i++){
+		participants[i] = *config;
+		participants[i].id = i;
+		participants[i].clock.lamport_time = 0;
+		participants[i].clock.prev_time = 0;
+	}
+	return participants;
+}
+
+static void* participant_thread(void* participant){
+	run_participant(participant);
+	return NULL;
+}
+
+/** Run every child as a thread of this process, the calling thread is the parent
+ *
+ * The threads share the rings opened by config->transport and the log
+ * files, each of them keeps its own Lamport clock and balance history.
+ * The rings are released once all threads are done.
+ *
+ * @param config	Settings of all participants
+ *
+ * @return -1 if a thread can not be started, 0 on success
+ */
+int run_threads(const Participant* config){
+	Participant* participants = participants_init(config);
+	pthread_t* threads = malloc(sizeof(pthread_t) * config->proc_count);
+	size_t i;
+	
+	for (i = 1; i < config->proc_count; i++){
+		if (pthread_create(&threads[i], NULL, participant_thread, &participants[i])){
+			return -1;
 		}
-		children[i] = fork_id;
 	}
 	
+	run_participant(&participants[PARENT_ID]);
 	
-	if (!fork_id){
-		current_proc_id = i + 1;
+	for (i = 1; i < config->proc_count; i++){
+		pthread_join(threads[i], NULL);
 	}
-	else{
-		current_proc_id = PARENT_ID;
+	config->transport->release(config->channels, config->proc_count);
+	free(threads);
+	free(participants);
+	return 0;
+}
+
+static void participant_fiber(void* participant){
+	run_participant(participant);
+}
+
+/** Run every participant as a fiber on a pool of worker threads
+ *
+ * Workers steal fibers from each other's run queues, a fiber waiting for
+ * a message yields at once and a worker whose fibers all wait sleeps
+ * until one of them can go on. The fibers share the rings and the log files,
+ * each of them carries its own clock and balance history. A single
+ * worker switches between the fibers in a fixed order, a simulated run is
+ * the same every time.
+ *
+ * @param config	Settings of all participants
+ * @param workers	Count of worker threads
+ *
+ * @return -1 if the fibers can not be created, 0 on success
+ */
+int run_fibers(const Participant* config, size_t workers){
+	Participant* participants = participants_init(config);
+	FiberPool* pool = fiber_pool_init(workers, config->proc_count);
+	size_t i;
+	
+	if (pool == NULL){
+		return -1;
+	}
+	for (i = 0; i < config->proc_count; i++){
+		/* Waiting means yielding to the other fibers, the worker sleeps only when all of them wait */
+		participants[i].wait.spin_limit = 0;
+		participants[i].wait.yield_limit = 0;
+		participants[i].wait.park = 1;
+		if (fiber_spawn(pool, participant_fiber, &participants[i], &participants[i].clock)){
+			return -1;
+		}
 	}
 	
+	fiber_pool_run(pool);
 	
-	pipes_comm = communication_init(pipes, proc_count + 1, current_proc_id, 		    get_proc_balance(current_proc_id, argv));
-	log_pipes(pipes_comm);
+	fiber_pool_destroy(pool);
+	config->transport->release(config->channels, config->proc_count);
+	free(participants);
+	return 0;
+}
+
+
+int main(int argc, char** argv){
+	int proc_count;
+	int first_balance;
+	const char* peers;
+	local_id node_id;
+	int fork_tree;
+	int threads;
+	int fibers;
+	Participant self;
+	pid_t* children;
+	size_t child_count = 0;
+	int spawned;
 	
 	
-	if (current_proc_id == PARENT_ID){
-		do_parent_work(pipes_comm);
+	if (argc < 4 || (first_balance = get_agrs(argc, argv, &proc_count, &self.transport, &self.uring, &self.wait, &self.high_water, &self.stats, &fork_tree, &threads, &fibers, &node_id, &peers)) == -1){
+		fprintf(stderr, "Usage: %s -p X [--transport=pipe|shm|uds|tcp|inbox] [--uring] [--spin=N] [--yield=N] [--no-park] [--high-water=N] [--stats] [--fork-tree] [--threads | --fibers=W | --sim [--seed=N] [--latency=const:D|uniform:MIN:MAX]] [--id=K --peers=FILE] y1 y2 ... yX\n", argv[0]);
+		return -1;
+	}
+	
+	log_init(peers == NULL ? "w" : "a"); // Initialize log files, nodes launched on their own share them 
+	
+	children = malloc(sizeof(pid_t) * proc_count);
+	
+	startup_begin();
+	if (peers == NULL){
+		self.channels = self.transport->open(proc_count + 1); // open pipes, sockets or rings 
+	}
+	else if (self.transport->join == NULL){
+		fprintf(stderr, "%s transport can not connect processes launched on their own\n", self.transport->name);
+		return -1;
 	}
 	else{
-		do_child_work(pipes_comm);
+		self.channels = self.transport->join(peers, proc_count + 1, node_id); // meet other nodes through the peers file
 	}
+	if (self.channels == NULL){
+		fprintf(stderr, "Can not open %s channels for %d processes\n", self.transport->name, proc_count + 1);
+		return -2;
+	}
+	self.proc_count = proc_count + 1;
+	self.balances = argv + first_balance;
+	self.arena = peers == NULL ? shm_arena_init((proc_count + 1) * (sizeof(ShmBlock) + sizeof(BalanceHistory))) : NULL;
 	
-	
-	if (current_proc_id == PARENT_ID){
-		for (i = 0; i < proc_count; i++){
-			waitpid(children[i], NULL, 0);
+	if (threads){
+		if (run_threads(&self)){
+			return -2;
 		}
 	}
-	
+	else if (fibers){
+		if (run_fibers(&self, fibers)){
+			return -2;
+		}
+	}
+	/* A node launched on its own forks nobody */
+	else if (peers != NULL){
+		self.id = node_id;
+		run_participant(&self);
+	}
+	else if ((spawned = spawn_processes(proc_count + 1, fork_tree, children, &child_count)) < 0){
+		return -2;
+	}
+	else{
+		self.id = spawned;
+		run_participant(&self);
+	}
 	
 	log_destroy();
-	communication_destroy(pipes_comm);
-	return 0;
-}
-
-int* pipes_init(size_t proc_count){
-	
-
-	int* pipes = malloc(sizeof(int) * proc_count * (proc_count-1)*2);
-	size_t i, j;
-	size_t offset = proc_count - 1;
-	for (i = 0; i < proc_count; i++){
-		for (j = 0; j < proc_count; j++){
-			int tmp_fd[2];
-			
-			if (i == j){
-				continue;
-			}
-			
-			if (pipe(tmp_fd) < 0){
-				return (int*)NULL;
-			}
-			
-			if (set_nonblock(tmp_fd[0]) || set_nonblock(tmp_fd[1])){
-				return (int*)NULL;
-			}
-			pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE] = tmp_fd[0];  
-			pipes[j * offset * 2 + (j > i ? i : i - 1) * 2 + PIPE_WRITE_TYPE] = tmp_fd[1]; 
-		}
+	if (self.arena != NULL){
+		shm_arena_destroy(self.arena);
 	}
-	return pipes;
+	
+	/* Queued messages are out now, children may wait for them before exiting */
+	reap_children(children, child_count);
+	free(children);
+	return 0;
 }
 
 /*Init PipesCommunication*/
-PipesCommunication* communication_init(int* pipes, size_t proc_count, local_id curr_proc, balance_t balance){
-	PipesCommunication* this = malloc(sizeof(PipesCommunication));;
-	size_t i, j;
-	size_t offset = proc_count - 1;
-	this->pipes = malloc(sizeof(int) * offset * 2);
+PipesCommunication* communication_init(const Transport* transport, void* channels, size_t proc_count, local_id curr_proc, balance_t balance){
+	PipesCommunication* this = malloc(sizeof(PipesCommunication));
+	
+	this->transport = transport;
 	this->total_ids = proc_count;
 	this->current_id = curr_proc;
 	this->balance = balance;
+	this->last_msg_from = curr_proc;
+	this->transfer_count = 0;
+	this->transfer_time = 0;
 	
-	memcpy(this->pipes, pipes + curr_proc * 2 * offset, sizeof(int) * offset * 2);
-	
-	/* Close unnecessary fds */
-	for (i = 0; i < proc_count; i++){
-		if (i == curr_proc){
-			continue;
-		}
-		for (j = 0; j < proc_count; j++){
-			close(pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE]);
-			close(pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_WRITE_TYPE]);
-		}
+	if (transport_attach(this, channels) < 0){
+		return NULL;
 	}
-	free(pipes);
+	this->wide_clock = get_wide_lamport_time;
 	return this;
 }
 
 
 void communication_destroy(PipesCommunication* pipes_comm){
-	size_t i;
-	for (i = 0; i < pipes_comm->total_ids - 1; i++){
-		close(pipes_comm->pipes[i * 2 + PIPE_READ_TYPE]);
-		close(pipes_comm->pipes[i * 2 + PIPE_WRITE_TYPE]);
-	}
+	transport_detach(pipes_comm); // flushes pending sends and closes channels
 	free(pipes_comm);
 }
 
@@ -437,7 +734,7 @@ void send_transfer_msg(PipesCommunication* pipes_comm, local_id dst, TransferOrd
 	
 	memcpy(message.s_payload, order, message.s_header.s_payload_len);
 	
-	while (send(pipes_comm, dst, &message) < 0);
+	send_blocking(pipes_comm, dst, &message);
 }
 
 /** Send ACK message */
@@ -449,21 +746,18 @@ void send_ack_msg(PipesCommunication* pipes_comm, local_id dst){
         message.s_header.s_local_time = get_lamport_time();
 	message.s_header.s_payload_len = 0;
 	
-	while (send(pipes_comm, dst, &message) < 0);
+	send_blocking(pipes_comm, dst, &message);
 }
 
 
 void send_balance_history(PipesCommunication* pipes_comm, local_id dst, BalanceHistory* history){
-	Message message;
-	message.s_header.s_magic = MESSAGE_MAGIC;
-   	message.s_header.s_type = BALANCE_HISTORY;
-    	//message.s_header.s_local_time = get_physical_time();
-        message.s_header.s_local_time = get_lamport_time();
-	message.s_header.s_payload_len = sizeof(BalanceHistory);
-	
-	memcpy(message.s_payload, history, message.s_header.s_payload_len);
+	MessageHeader header;
+	header.s_magic = MESSAGE_MAGIC;
+   	header.s_type = BALANCE_HISTORY;
+    	//header.s_local_time = get_physical_time();
+        header.s_local_time = get_lamport_time();
 	
-	while (send(pipes_comm, dst, &message) < 0);
+	send_handle(pipes_comm, dst, &header, history, sizeof(BalanceHistory));
 }
 
 
@@ -475,13 +769,13 @@ void receive_all_msgs(PipesCommunication* pipes_comm, MessageType type){
 		if (i == pipes_comm->current_id){
 			continue;
 		}
-		while (receive(pipes_comm, i, &message) < 0)
-                      ;
+		receive_type_blocking(pipes_comm, i, type, &message);
 	        set_lamport_time_from_msg(&message);
 	}
 	
 	switch (type){
         case STARTED:
+            pipes_comm->startup_us = startup_elapsed_us();
             log_received_all_started(pipes_comm->current_id);
             break;
         case DONE:
@@ -493,16 +787,5 @@ void receive_all_msgs(PipesCommunication* pipes_comm, MessageType type){
 }
 
 
-int set_nonblock(int pipe_id){
-	int ff = fcntl(pipe_id, F_GETFL);
-    if (ff == -1){
-        return -1;
-    }
-    ff = fcntl(pipe_id, F_SETFL, ff | O_NONBLOCK);
-    if (ff == -1){
-        return -2;
-    }
-    return 0;
-}
 
 
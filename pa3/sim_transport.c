@@ -0,0 +1,176 @@
+#include "ipc.h"
+#include "communication.h"
+#include "transport.h"
+#include "sim.h"
+#include "fiber.h"
+
+
+/* Set from the command line before the run opens its network */
+static SimLatency sim_latency = {1, 1};
+static uint64_t sim_seed = 1;
+
+/** Choose the latency distribution and seed of the next sim_transport network
+ *
+ * @param latency	Spec of sim_latency_parse(), NULL keeps the current one
+ * @param seed		Seed of the generator that draws the delays
+ *
+ * @return -1 if latency is malformed, 0 on success
+ */
+int sim_transport_configure(const char* latency, unsigned long seed){
+	if (latency != NULL && sim_latency_parse(latency, &sim_latency)){
+		return -1;
+	}
+	sim_seed = seed;
+	return 0;
+}
+
+/* Virtual time of the run comm takes part in, 0 outside a simulation */
+long sim_time(PipesCommunication* comm){
+	return comm->sim != NULL ? comm->sim->now : 0;
+}
+
+static void* sim_open(size_t proc_count){
+	return sim_net_init(proc_count, sim_latency, sim_seed);
+}
+
+static int sim_attach(PipesCommunication* comm, void* channels){
+	comm->sim = channels;
+	comm->sim_epoch = comm->sim->epoch - 1;
+	comm->poll_count = comm->total_ids - 1;
+	return 0;
+}
+
+/* Some participant did something, whoever waited may have work again */
+static void sim_progress(SimNet* net){
+	net->epoch++;
+	net->idle = 0;
+}
+
+/** Let the other participants run, the clock moves once all of them wait
+ *
+ * A participant counts as idle once per epoch, so waiting again and again
+ * without anybody making progress does not count it twice.
+ *
+ * Messages owed to peers go out once everybody waits: they ride on
+ * whatever else is sent at the same tick, and the clock moves on only
+ * after they are out.
+ *
+ * @return -1 if everybody waits and no message is on its way, 0 otherwise
+ */
+static int sim_wait(PipesCommunication* comm){
+	SimNet* net = comm->sim;
+	size_t owed = fold_owed(comm);
+
+	/* Nobody else can look at what comm owes, it is counted while comm waits */
+	net->owing += owed - comm->sim_owed;
+	comm->sim_owed = owed;
+	if (comm->sim_epoch != net->epoch){
+		comm->sim_epoch = net->epoch;
+		net->idle++;
+	}
+	if (net->idle >= net->live){
+		if (owed){
+			net->owing -= owed;
+			comm->sim_owed = 0;
+			fold_flush(comm);
+			return 0;
+		}
+		/* The participants that owe something send it when their turn comes */
+		if (!net->owing){
+			if (sim_advance(net)){
+				return -1;
+			}
+			sim_progress(net);
+		}
+	}
+	fiber_yield();
+	return 0;
+}
+
+/* The receiver exited, its messages are dropped like writes to a closed pipe */
+static int sim_send(PipesCommunication* from, local_id dst, const Message* message){
+	SimNet* net = from->sim;
+
+	if (!net->closed[dst] && sim_link_push(net, sim_link_get(net, from->current_id, dst),
+			message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+		return -1;
+	}
+	from->sim_stats.sent++;
+	sim_progress(net);
+	return 0;
+}
+
+static int sim_receive(PipesCommunication* this, local_id from, Message* message){
+	long in_flight;
+
+	if (sim_link_pop(this->sim, sim_link_get(this->sim, from, this->current_id), message, sizeof(Message), &in_flight) < 0){
+		return -2;
+	}
+	this->sim_stats.received++;
+	this->sim_stats.in_flight += in_flight;
+	sim_progress(this->sim);
+	return 0;
+}
+
+static int sim_scan(PipesCommunication* comm){
+	local_id i;
+	int ready = 0;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (i != comm->current_id && sim_link_ready(comm->sim, sim_link_get(comm->sim, i, comm->current_id))){
+			comm->ready[i] = 1;
+			ready++;
+		}
+	}
+	return ready;
+}
+
+static int sim_poll(PipesCommunication* comm, int timeout){
+	int ready = sim_scan(comm);
+
+	if (ready || !timeout){
+		return ready;
+	}
+	return sim_wait(comm) < 0 ? -1 : sim_scan(comm);
+}
+
+/* Links never fill up, a participant only waits for messages */
+static int sim_park(PipesCommunication* comm, local_id peer, short events, size_t len){
+	return sim_wait(comm);
+}
+
+static void sim_close(PipesCommunication* comm){
+	SimNet* net = comm->sim;
+	local_id i;
+
+	net->closed[comm->current_id] = 1;
+	net->owing -= comm->sim_owed;
+	for (i = 0; i < comm->total_ids; i++){
+		sim_link_drop(sim_link_get(net, i, comm->current_id));
+	}
+	net->live--;
+	sim_progress(net);
+}
+
+static void sim_release(void* channels, size_t proc_count){
+	sim_net_destroy(channels);
+}
+
+/* Links with a delay drawn from one seeded distribution, for participants
+ * running as fibers of a single worker: the run and its virtual time are
+ * the same for the same seed */
+const Transport sim_transport = {
+	"sim",
+	sim_open,
+	NULL,
+	sim_attach,
+	sim_send,
+	sim_receive,
+	NULL,
+	NULL,
+	sim_poll,
+	sim_park,
+	NULL,
+	sim_close,
+	sim_release
+};
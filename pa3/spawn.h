@@ -0,0 +1,12 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_SPAWN__H
+#define __IFMO_DISTRIBUTED_CLASS_SPAWN__H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+int spawn_processes(size_t proc_count, int tree, pid_t* children, size_t* child_count);
+void reap_children(const pid_t* children, size_t child_count);
+void startup_begin(void);
+long startup_elapsed_us(void);
+
+#endif
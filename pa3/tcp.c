@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include "tcp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Slot of the peer's fd in the row of process id, the layout of pipes_init() */
+#define TCP_SLOT(id, peer, proc_count) ((id) * ((proc_count) - 1) * 2 + ((peer) < (id) ? (peer) : (peer) - 1) * 2)
+
+/* Messages are small and latency bound, and the connection is non-blocking like pipes */
+static int tcp_setup(int fd){
+	int one = 1;
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0){
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 ? -1 : 0;
+}
+
+static void tcp_place(int* sockets, size_t proc_count, int id, int peer, int fd){
+	sockets[TCP_SLOT(id, peer, proc_count)] = sockets[TCP_SLOT(id, peer, proc_count) + 1] = fd;
+}
+
+/* Listen on addr, port 0 picks a free one */
+static int tcp_listen(struct sockaddr_in* addr, int backlog){
+	socklen_t len = sizeof(*addr);
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0){
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr*) addr, sizeof(*addr)) < 0 || listen(fd, backlog) < 0
+			|| getsockname(fd, (struct sockaddr*) addr, &len) < 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** Connect every pair of processes over loopback TCP
+ *
+ * The table has the layout of uds_init(): both slots of a peer hold the
+ * same socket. Unlike a datagram a stream may split and merge messages,
+ * receive() frames them like it does for pipes. SIGPIPE is ignored, a
+ * write to a peer gone away fails instead.
+ *
+ * @param proc_count    Process count including parent process.
+ *
+ * @return fd table, NULL on socket error
+ */
+int* tcp_init(size_t proc_count){
+	int* sockets = malloc(sizeof(int) * proc_count * (proc_count - 1) * 2);
+	struct sockaddr_in addr;
+	size_t i, j;
+	int listener;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((listener = tcp_listen(&addr, 1)) < 0){
+		free(sockets);
+		return NULL;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < proc_count; i++){
+		for (j = i + 1; j < proc_count; j++){
+			int client = socket(AF_INET, SOCK_STREAM, 0);
+			int server;
+
+			/* The backlog completes the connection before accept() */
+			if (client < 0 || connect(client, (struct sockaddr*) &addr, sizeof(addr)) < 0
+					|| (server = accept(listener, NULL, NULL)) < 0 || tcp_setup(client) || tcp_setup(server)){
+				close(listener);
+				free(sockets);
+				return NULL;
+			}
+			tcp_place(sockets, proc_count, i, j, client);
+			tcp_place(sockets, proc_count, j, i, server);
+		}
+	}
+	close(listener);
+	return sockets;
+}
+
+/** Find the last "id host port" line of the peers file for the process
+ *
+ * @return -1 if the file has no line for id yet, 0 on success
+ */
+static int peers_find(const char* peers, int id, char* host, char* port){
+	FILE* f = fopen(peers, "r");
+	char line_host[NI_MAXHOST], line_port[NI_MAXSERV];
+	int line_id, found = -1;
+
+	if (f == NULL){
+		return -1;
+	}
+	while (fscanf(f, "%d %1024s %31s", &line_id, line_host, line_port) == 3){
+		if (line_id == id){
+			strcpy(host, line_host);
+			strcpy(port, line_port);
+			found = 0;
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+static void sleep_ms(long ms){
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = ms % 1000 * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+/* Connect to the node listed for peer, retrying until it lists itself and listens */
+static int peers_connect(const char* peers, int peer){
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+	long waited;
+
+	for (waited = 0; waited < TCP_JOIN_TIMEOUT_MS; waited += TCP_JOIN_RETRY_MS){
+		struct addrinfo hints, *res, *ai;
+
+		if (!peers_find(peers, peer, host, port)){
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			if (!getaddrinfo(host, port, &hints, &res)){
+				for (ai = res; ai != NULL; ai = ai->ai_next){
+					int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+					if (fd >= 0 && !connect(fd, ai->ai_addr, ai->ai_addrlen)){
+						freeaddrinfo(res);
+						return fd;
+					}
+					if (fd >= 0){
+						close(fd);
+					}
+				}
+				freeaddrinfo(res);
+			}
+		}
+		sleep_ms(TCP_JOIN_RETRY_MS);
+	}
+	return -1;
+}
+
+/** Connect a separately launched process to all others through a rendezvous file
+ *
+ * The peers file holds "id host port" lines, the last line of an id wins.
+ * A process with no line listens on a free loopback port and appends its
+ * line; lines written beforehand place nodes on other hosts, the process
+ * listens on every address with the port of its line. Then every process
+ * connects to each lower id, tells its own id, and accepts the higher ids.
+ * The file must be missing, empty or hold only such prepared lines when
+ * the run starts, a line left by an earlier run points to a dead node.
+ *
+ * @param peers         Path of the rendezvous file shared by all processes
+ * @param proc_count    Process count including parent process.
+ * @param id            Local id of this process
+ *
+ * @return fd table with the row of id filled and -1 elsewhere, NULL if some peer did not show up in time
+ */
+int* tcp_join(const char* peers, size_t proc_count, int id){
+	int* sockets = malloc(sizeof(int) * proc_count * (proc_count - 1) * 2);
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+	struct sockaddr_in addr;
+	int listener, fd, peer;
+	char self = id;
+	size_t i;
+
+	for (i = 0; i < proc_count * (proc_count - 1) * 2; i++){
+		sockets[i] = -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	if (!peers_find(peers, id, host, port)){
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(atoi(port));
+		listener = tcp_listen(&addr, proc_count);
+	}
+	else{
+		char line[64];
+		int f;
+
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ((listener = tcp_listen(&addr, proc_count)) >= 0){
+			/* One short append is atomic, lines of nodes starting together do not mix */
+			snprintf(line, sizeof(line), "%d 127.0.0.1 %d\n", id, ntohs(addr.sin_port));
+			if ((f = open(peers, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0 || write(f, line, strlen(line)) < 0){
+				close(listener);
+				listener = -1;
+			}
+			if (f >= 0){
+				close(f);
+			}
+		}
+	}
+	if (listener < 0){
+		free(sockets);
+		return NULL;
+	}
+
+	for (peer = 0; peer < id; peer++){
+		if ((fd = peers_connect(peers, peer)) < 0 || write(fd, &self, 1) != 1 || tcp_setup(fd)){
+			close(listener);
+			free(sockets);
+			return NULL;
+		}
+		tcp_place(sockets, proc_count, id, peer, fd);
+	}
+	for (i = id + 1; i < proc_count; i++){
+		struct pollfd pfd;
+		char other;
+
+		pfd.fd = listener;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, TCP_JOIN_TIMEOUT_MS) != 1 || (fd = accept(listener, NULL, NULL)) < 0 || read(fd, &other, 1) != 1
+				|| other <= id || (size_t) other >= proc_count || tcp_setup(fd)){
+			close(listener);
+			free(sockets);
+			return NULL;
+		}
+		tcp_place(sockets, proc_count, id, other, fd);
+	}
+	close(listener);
+	return sockets;
+}
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include "timer.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+/**
+ * @return microseconds of CLOCK_MONOTONIC, the clock of every deadline
+ */
+int64_t monotonic_us(void){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void timers_init(TimerSet* set){
+	size_t i;
+
+	for (i = 0; i < MAX_TIMERS; i++){
+		set->timers[i].handler = NULL;
+	}
+	set->count = 0;
+	set->firing = 0;
+	set->fd = -1;
+}
+
+void timers_destroy(TimerSet* set){
+	if (set->fd >= 0){
+		close(set->fd);
+	}
+}
+
+/** Run handler(arg) every period_us microseconds, first period_us from now
+ *
+ * Handlers run inside blocking calls only, a process busy with its own
+ * work runs them the next time it waits.
+ *
+ * @return id of the timer, -1 if period_us is not positive or all MAX_TIMERS run
+ */
+int timer_start(TimerSet* set, long period_us, TimerHandler handler, void* arg){
+	size_t i;
+
+	if (period_us <= 0 || handler == NULL){
+		return -1;
+	}
+	for (i = 0; i < MAX_TIMERS; i++){
+		Timer* timer = &set->timers[i];
+
+		if (timer->handler == NULL){
+			timer->due = monotonic_us() + period_us;
+			timer->period = period_us;
+			timer->handler = handler;
+			timer->arg = arg;
+			set->count++;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* A handler may stop its own timer */
+void timer_stop(TimerSet* set, int id){
+	if (id >= 0 && id < MAX_TIMERS && set->timers[id].handler != NULL){
+		set->timers[id].handler = NULL;
+		set->count--;
+	}
+}
+
+/**
+ * @return monotonic_us() the earliest timer is due at, -1 if none runs
+ */
+int64_t timers_next(const TimerSet* set){
+	int64_t next = -1;
+	size_t i;
+
+	for (i = 0; set->count && i < MAX_TIMERS; i++){
+		if (set->timers[i].handler != NULL && (next < 0 || set->timers[i].due < next)){
+			next = set->timers[i].due;
+		}
+	}
+	return next;
+}
+
+/** Run the handlers that are due
+ *
+ * A timer late by several periods runs once and keeps its period from now.
+ *
+ * @return count of handlers run
+ */
+int timers_fire(TimerSet* set){
+	int64_t now;
+	size_t i;
+	int fired = 0;
+
+	if (!set->count || set->firing){
+		return 0;
+	}
+	now = monotonic_us();
+	set->firing = 1;
+	for (i = 0; i < MAX_TIMERS; i++){
+		Timer* timer = &set->timers[i];
+
+		if (timer->handler != NULL && timer->due <= now){
+			timer->due += timer->period;
+			if (timer->due <= now){
+				timer->due = now + timer->period;
+			}
+			timer->handler(timer->arg);
+			fired++;
+		}
+	}
+	set->firing = 0;
+	return fired;
+}
+
+/** Make set->fd readable at monotonic_us() time at and not before
+ *
+ * Arming resets an expired fd, so a poller that watches it wakes up
+ * once per wait. A time that has passed makes it readable at once.
+ *
+ * @param at	Wake-up time, -1 for none
+ *
+ * @return the fd to poll, -1 if at is -1 or on timerfd error
+ */
+int timers_arm(TimerSet* set, int64_t at){
+	struct itimerspec spec = {{0, 0}, {0, 0}};
+
+	if (at < 0 && set->fd < 0){
+		return -1;
+	}
+	if (set->fd < 0 && (set->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0){
+		return -1;
+	}
+	if (at >= 0){
+		/* A zero it_value would disarm the timer */
+		spec.it_value.tv_sec = at / 1000000;
+		spec.it_value.tv_nsec = at % 1000000 * 1000 + 1;
+	}
+	if (timerfd_settime(set->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0 || at < 0){
+		return -1;
+	}
+	return set->fd;
+}
@@ -10,8 +10,11 @@ typedef struct{
 	PipesCommunication* comm;
 	LamportQueue* queue;
 	size_t done_left;
+	local_id reply_to[MAX_PROCESS_ID + 1];	/* requests of the burst being handled, answered together */
+	size_t reply_count;
 } CS;
 
-int cs_work(CS* lamport_comm, Message* msg);
+int cs_work(CS* lamport_comm, Message* msg, local_id from);
+size_t cs_receive(CS* lamport_comm);
  
 #endif
@@ -0,0 +1,994 @@
+#define _GNU_SOURCE
+#include "ipc.h"
+#include "communication.h"
+#include "transport.h"
+#include "uring.h"
+#include "uds.h"
+#include "tcp.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+
+static int set_nonblock(int pipe_id){
+	int ff = fcntl(pipe_id, F_GETFL);
+    if (ff == -1){
+        return -1;
+    }
+    ff = fcntl(pipe_id, F_SETFL, ff | O_NONBLOCK);
+    if (ff == -1){
+        return -2;
+    }
+    return 0;
+}
+
+/** Open non-blocking pipes between every pair of processes
+ *
+ * Process i reads the peer j from slot GET_INDEX(j, i) * 2 + PIPE_READ_TYPE
+ * of row i and writes it through PIPE_WRITE_TYPE of the same slot.
+ *
+ * @param proc_count    Process count including parent process.
+ *
+ * @return pipe fd table, NULL on pipe error
+ */
+static void* pipes_open(size_t proc_count){
+	int* pipes = malloc(sizeof(int) * proc_count * (proc_count-1)*2);
+	size_t i, j;
+	size_t offset = proc_count - 1;
+	for (i = 0; i < proc_count; i++){
+		for (j = 0; j < proc_count; j++){
+			int tmp_fd[2];
+			
+			if (i == j){
+				continue;
+			}
+			
+			if (pipe(tmp_fd) < 0){
+				return NULL;
+			}
+			
+			if (set_nonblock(tmp_fd[0]) || set_nonblock(tmp_fd[1])){
+				return NULL;
+			}
+			pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE] = tmp_fd[0];  
+			pipes[j * offset * 2 + (j > i ? i : i - 1) * 2 + PIPE_WRITE_TYPE] = tmp_fd[1]; 
+		}
+	}
+	return pipes;
+}
+
+static void* sockets_open(size_t proc_count){
+	return uds_init(proc_count);
+}
+
+static void* tcp_open(size_t proc_count){
+	return tcp_init(proc_count);
+}
+
+static void* tcp_open_node(const char* peers, size_t proc_count, local_id id){
+	return tcp_join(peers, proc_count, id);
+}
+
+/* Tags of io_uring operations, a read and a write per peer */
+#define URING_TAG(peer, is_write) ((uint64_t) (peer) * 2 + (is_write))
+
+/** Make room behind buffered bytes, moving a partial frame to the front when needed
+ *
+ * @return free bytes at the end of the buffer, 0 if less than a whole message fits
+ */
+static size_t read_ahead_room(ReadAhead* in){
+	if (in->start == in->end){
+		in->start = in->end = 0;
+	}
+	else if (READ_AHEAD_SIZE - in->end < sizeof(Message)){
+		memmove(in->data, in->data + in->start, in->end - in->start);
+		in->end -= in->start;
+		in->start = 0;
+	}
+	return READ_AHEAD_SIZE - in->end < sizeof(Message) ? 0 : READ_AHEAD_SIZE - in->end;
+}
+
+/** Cut the oldest complete message out of the read-ahead buffer
+ *
+ * @return -2 if no complete message is buffered, -3 on a broken header, 0 on success
+ */
+static int read_ahead_take(ReadAhead* in, Message* message){
+	size_t avail = in->end - in->start;
+	MessageHeader header;
+	size_t len;
+
+	if (avail < sizeof(MessageHeader)){
+		return -2;
+	}
+	memcpy(&header, in->data + in->start, sizeof(MessageHeader));
+	len = sizeof(MessageHeader) + header.s_payload_len;
+	if (len > sizeof(Message)){
+		return -3;
+	}
+	if (avail < len){
+		return -2;
+	}
+	memcpy(message, in->data + in->start, len);
+	in->start += len;
+	return 0;
+}
+
+/* Keep a read posted while the buffer has room for a whole message */
+static void uring_post_read(PipesCommunication* comm, local_id peer){
+	UringChannel* channel = &comm->channels[peer];
+	ReadAhead* in = &comm->inbound[peer];
+	size_t room;
+
+	if (channel->reading || channel->closed || !(room = read_ahead_room(in))){
+		return;
+	}
+	if (!uring_read(comm->uring, comm->pipes[GET_INDEX(peer, comm->current_id) * 2 + PIPE_READ_TYPE],
+			in->data + in->end, room, URING_TAG(peer, 0))){
+		channel->reading = 1;
+	}
+}
+
+/** Write what send() accumulated for the peer, the caller makes sure no write is in flight
+ *
+ * Sockets get one message per write, a datagram must not carry more.
+ */
+static void uring_post_write(PipesCommunication* comm, local_id peer){
+	UringChannel* channel = &comm->channels[peer];
+	size_t len;
+
+	if (!channel->flight_len){
+		char* buf = channel->flight;
+		size_t cap = channel->flight_cap;
+
+		if (!channel->out_len){
+			return;
+		}
+		channel->flight = channel->out;
+		channel->flight_cap = channel->out_cap;
+		channel->flight_len = channel->out_len;
+		channel->flight_done = 0;
+		channel->out = buf;
+		channel->out_cap = cap;
+		channel->out_len = 0;
+	}
+
+	len = channel->flight_len - channel->flight_done;
+	if (comm->seqpacket){
+		MessageHeader header;
+
+		memcpy(&header, channel->flight + channel->flight_done, sizeof(MessageHeader));
+		len = sizeof(MessageHeader) + header.s_payload_len;
+	}
+	uring_write(comm->uring, comm->pipes[GET_INDEX(peer, comm->current_id) * 2 + PIPE_WRITE_TYPE],
+		channel->flight + channel->flight_done, len, URING_TAG(peer, 1));
+}
+
+/* Apply completions: account read bytes, repost reads and continue writes */
+static void uring_complete(PipesCommunication* comm){
+	uint64_t tag;
+	int res;
+
+	while (!uring_reap(comm->uring, &tag, &res)){
+		local_id peer = tag / 2;
+		UringChannel* channel = &comm->channels[peer];
+
+		if (tag % 2){
+			if (res > 0){
+				channel->flight_done += res;
+			}
+			else if (res != -EAGAIN && res != -EINTR){
+				/* Nobody reads the other end anymore */
+				channel->flight_done = channel->flight_len;
+				channel->out_len = 0;
+			}
+			if (channel->flight_done == channel->flight_len){
+				channel->flight_len = 0;
+			}
+			uring_post_write(comm, peer);
+			continue;
+		}
+
+		channel->reading = 0;
+		if (res > 0){
+			comm->inbound[peer].end += res;
+			comm->ready[peer] = 1;
+		}
+		else if (res != -EAGAIN && res != -EINTR){
+			channel->closed = 1;
+			comm->ready[peer] = 1;
+			comm->poll_count--;
+			continue;
+		}
+		uring_post_read(comm, peer);
+	}
+}
+
+/** One event loop turn: submit everything queued since the last one, then apply completions
+ *
+ * @param wait_nr	1 to sleep until some operation completes, 0 to return immediately
+ *
+ * @return -1 on io_uring error, 0 on success
+ */
+static int uring_poll(PipesCommunication* comm, unsigned wait_nr){
+	if (uring_enter(comm->uring, wait_nr) < 0){
+		return -1;
+	}
+	uring_complete(comm);
+	return 0;
+}
+
+/** Sleep until some operation completes or the next timer or deadline of comm comes
+ *
+ * @return -1 on io_uring error, 0 on success
+ */
+static int uring_sleep(PipesCommunication* comm){
+	struct pollfd fds[2];
+
+	if ((fds[1].fd = wake_fd(comm)) < 0){
+		return uring_poll(comm, 1);
+	}
+	if (uring_enter(comm->uring, 0) < 0){
+		return -1;
+	}
+	fds[0].fd = uring_fd(comm->uring);
+	fds[0].events = POLLIN;
+	fds[1].events = POLLIN;
+	if (poll(fds, 2, -1) < 0 && errno != EINTR){
+		return -1;
+	}
+	return uring_poll(comm, 0);
+}
+
+static int uring_receive(PipesCommunication* this, local_id from, Message* message){
+	UringChannel* channel = &this->channels[from];
+	int res;
+
+	if ((res = read_ahead_take(&this->inbound[from], message)) == -2){
+		if (uring_poll(this, 0) < 0){
+			return -2;
+		}
+		res = read_ahead_take(&this->inbound[from], message);
+	}
+	if (res){
+		return res == -2 && channel->closed ? RECEIVE_CLOSED : res;
+	}
+	/* A read is not posted while the buffer is full */
+	uring_post_read(this, from);
+	return 0;
+}
+
+/* Append the message to the peer's outgoing bytes, they are submitted by the next event loop turn */
+static int uring_send(PipesCommunication* from, local_id dst, const Message* message){
+	UringChannel* channel = &from->channels[dst];
+	size_t len = sizeof(MessageHeader) + message->s_header.s_payload_len;
+
+	if (channel->out_len + len > channel->out_cap){
+		size_t cap = channel->out_cap ? channel->out_cap : sizeof(Message);
+		char* out;
+
+		while (cap < channel->out_len + len){
+			cap *= 2;
+		}
+		if ((out = realloc(channel->out, cap)) == NULL){
+			return -1;
+		}
+		channel->out = out;
+		channel->out_cap = cap;
+	}
+	memcpy(channel->out + channel->out_len, message, len);
+	channel->out_len += len;
+	if (!channel->flight_len){
+		uring_post_write(from, dst);
+	}
+	return 0;
+}
+
+/* One datagram is one message, a single read takes all of it */
+static int seqpacket_receive(int fd, Message* message){
+	ssize_t len = read(fd, message, sizeof(Message));
+	
+	if (len == 0){
+		return RECEIVE_CLOSED;
+	}
+	if (len < (ssize_t)sizeof(MessageHeader)){
+		return -2;
+	}
+	if (len != (ssize_t)sizeof(MessageHeader) + message->s_header.s_payload_len){
+		return -3;
+	}
+	return 0;
+}
+
+/** Take a message from the read-ahead buffer, refilling it with one large read when it holds none
+ *
+ * A partial frame stays buffered until a later read completes it.
+ */
+static int read_ahead_receive(int fd, ReadAhead* in, Message* message){
+	ssize_t len;
+	int res;
+
+	if ((res = read_ahead_take(in, message)) != -2){
+		return res;
+	}
+	if ((len = read(fd, in->data + in->end, read_ahead_room(in))) <= 0){
+		return len == 0 ? RECEIVE_CLOSED : -2;
+	}
+	in->end += len;
+	return read_ahead_take(in, message);
+}
+
+/* Read the rest of a message whose header already came, it is in flight */
+static int read_body(int fd, char* body, size_t len){
+	while (len){
+		ssize_t count = read(fd, body, len);
+		
+		if (count > 0){
+			body += count;
+			len -= count;
+		}
+		else if (count == 0 || (errno != EAGAIN && errno != EINTR)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int fd_receive(PipesCommunication* this, local_id from, Message* message){
+	ssize_t len;
+	int fd;
+	
+	if (this->uring != NULL){
+		return uring_receive(this, from, message);
+	}
+	
+	fd = this->pipes[GET_INDEX(from, this->current_id) * 2 + PIPE_READ_TYPE];
+	if (this->seqpacket){
+		return seqpacket_receive(fd, message);
+	}
+	if (this->inbound != NULL){
+		return read_ahead_receive(fd, &this->inbound[from], message);
+	}
+	
+	if ((len = read(fd, message, sizeof(MessageHeader))) < (int)sizeof(MessageHeader)){
+		return len == 0 ? RECEIVE_CLOSED : -2;
+	}
+	
+	
+	if (read_body(fd, ((char*) message) + sizeof(MessageHeader), message->s_header.s_payload_len) < 0){
+		return -3;
+	}
+	return 0;
+}
+
+/* Tags of epoll events for write ends, read ends are tagged with the peer id */
+#define OUT_TAG(peer) ((uint32_t) (peer) + MAX_PROCESS_ID + 1)
+#define TIMER_TAG OUT_TAG(MAX_PROCESS_ID + 1)	/* comm->timers.fd */
+
+/* Ask epoll to report when the peer's pipe gets room again, or stop asking */
+static void out_watch(PipesCommunication* comm, local_id peer, int watch){
+	OutQueue* out = &comm->outbound[peer];
+	struct epoll_event event;
+
+	if (out->watched == watch || comm->epoll_fd < 0){
+		return;
+	}
+	event.events = EPOLLOUT;
+	event.data.u32 = OUT_TAG(peer);
+	epoll_ctl(comm->epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+		comm->pipes[GET_INDEX(peer, comm->current_id) * 2 + PIPE_WRITE_TYPE], &event);
+	out->watched = watch;
+}
+
+/** Write queued messages to the peer until the queue empties or the pipe fills
+ *
+ * Writes stay below MAX_MESSAGE_LEN, and carry exactly one message when
+ * comm->out_framed is set. A queue the pipe has no room for is watched
+ * by epoll until it drains.
+ *
+ * @return -1 if the peer is gone and the queue was dropped, -2 if the pipe is full, 0 if the queue is empty
+ */
+static int out_flush(PipesCommunication* comm, local_id peer){
+	OutQueue* out = &comm->outbound[peer];
+	int fd = comm->pipes[GET_INDEX(peer, comm->current_id) * 2 + PIPE_WRITE_TYPE];
+	int res = 0;
+
+	while (out->start < out->len){
+		size_t chunk = out->len - out->start;
+		ssize_t count;
+
+		if (comm->out_framed){
+			MessageHeader header;
+
+			memcpy(&header, out->data + out->start, sizeof(MessageHeader));
+			chunk = sizeof(MessageHeader) + header.s_payload_len;
+		}
+		else if (chunk > OUT_WRITE_MAX){
+			chunk = OUT_WRITE_MAX;
+		}
+
+		if ((count = write(fd, out->data + out->start, chunk)) < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			if (errno == EAGAIN){
+				comm->out_stats.full++;
+				out_watch(comm, peer, 1);
+				return -2;
+			}
+			/* Nobody reads the other end anymore */
+			res = -1;
+			break;
+		}
+		comm->out_stats.writes++;
+		if ((size_t) count < chunk){
+			comm->out_stats.partial++;
+		}
+		out->start += count;
+	}
+
+	out_watch(comm, peer, 0);
+	out->start = out->len = 0;
+	return res;
+}
+
+/** Append len bytes to the peer's queue, growing it as needed
+ *
+ * @return -1 if memory is exhausted, 0 on success
+ */
+static int out_queue(PipesCommunication* from, local_id dst, const void* data, size_t len){
+	OutQueue* out = &from->outbound[dst];
+
+	if (out->len + len > out->cap){
+		if (out->start){
+			memmove(out->data, out->data + out->start, out->len - out->start);
+			out->len -= out->start;
+			out->start = 0;
+		}
+		if (out->len + len > out->cap){
+			size_t cap = out->cap ? out->cap : OUT_WRITE_MAX;
+			char* grown;
+
+			while (cap < out->len + len){
+				cap *= 2;
+			}
+			if ((grown = realloc(out->data, cap)) == NULL){
+				return -1;
+			}
+			out->data = grown;
+			out->cap = cap;
+		}
+	}
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+	if (out->len - out->start > from->out_stats.max_queued){
+		from->out_stats.max_queued = out->len - out->start;
+	}
+	return 0;
+}
+
+/** Queue the message behind earlier ones, it is written once enough is queued or on flush
+ *
+ * @return -2 if the queue holds out_high_water bytes or more and the pipe takes none of them,
+ *         -1 if memory is exhausted, 0 on success
+ */
+static int out_send(PipesCommunication* from, local_id dst, const Message* message){
+	OutQueue* out = &from->outbound[dst];
+
+	if (out->len - out->start >= from->out_high_water && out_flush(from, dst) == -2
+			&& out->len - out->start >= from->out_high_water){
+		from->out_stats.throttled++;
+		return -2;
+	}
+	if (out_queue(from, dst, message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+		return -1;
+	}
+
+	/* Keep packing until a whole write is queued, unless messages go one per write */
+	if (from->out_framed || out->len - out->start >= OUT_WRITE_MAX){
+		out_flush(from, dst);
+	}
+	return 0;
+}
+
+static int fd_flush(PipesCommunication* this){
+	local_id i;
+	int res = 0;
+	
+	for (i = 0; this->outbound != NULL && i < this->total_ids; i++){
+		if (i != this->current_id && out_flush(this, i)){
+			res = -2;
+		}
+	}
+	return res;
+}
+
+static int fd_send(PipesCommunication* from, local_id dst, const Message* message){
+	if (from->uring != NULL){
+		return uring_send(from, dst, message);
+	}
+	if (from->outbound != NULL){
+		return out_send(from, dst, message);
+	}
+	if (write(from->pipes[GET_INDEX(dst, from->current_id) * 2 + PIPE_WRITE_TYPE], message, sizeof(MessageHeader) + message->s_header.s_payload_len) < 0){
+		return -2;
+	}
+	return 0;
+}
+
+/** Put a run of messages to one peer on the wire with a single system call
+ *
+ * writev() for pipes and TCP, sendmmsg() for datagram sockets so each
+ * message stays a datagram of its own. Only taken while nothing is queued
+ * for the peer, so the run never overtakes earlier messages; whatever the
+ * channel does not take is queued for out_flush() and counts as sent.
+ *
+ * @return count of leading messages of items taken, 0 if the run has to go through out_send()
+ */
+static size_t out_send_run(PipesCommunication* from, local_id dst, const SendItem* items, size_t n){
+	OutQueue* out = &from->outbound[dst];
+	int fd = from->pipes[GET_INDEX(dst, from->current_id) * 2 + PIPE_WRITE_TYPE];
+	struct iovec iov[SEND_BATCH];
+	size_t count, i, bytes = 0;
+	ssize_t written;
+
+	if (out->start < out->len){
+		return 0;
+	}
+	/* A stream write stays below MAX_MESSAGE_LEN like every write of out_flush() */
+	for (count = 0; count < n && count < SEND_BATCH && items[count].dst == dst; count++){
+		size_t len = sizeof(MessageHeader) + items[count].message->s_header.s_payload_len;
+
+		if (!from->seqpacket && bytes + len > OUT_WRITE_MAX){
+			break;
+		}
+		iov[count].iov_base = (void*) items[count].message;
+		iov[count].iov_len = len;
+		bytes += len;
+	}
+	if (count < 2){
+		return 0;
+	}
+
+	if (from->seqpacket){
+		int sent = uds_sendv(fd, iov, count);
+
+		for (i = 0, written = sent < 0 ? -1 : 0; (int) i < sent; i++){
+			written += iov[i].iov_len;
+		}
+	}
+	else{
+		while ((written = writev(fd, iov, count)) < 0 && errno == EINTR);
+	}
+	if (written < 0){
+		if (errno != EAGAIN){
+			/* Nobody reads the other end anymore, the run is dropped like a queue */
+			return count;
+		}
+		written = 0;
+	}
+	else{
+		from->out_stats.writes++;
+	}
+
+	if ((size_t) written == bytes){
+		return count;
+	}
+	if (written){
+		from->out_stats.partial++;
+	}
+	from->out_stats.full++;
+
+	/* The rest of a message cut short goes first, then the messages not written at all */
+	for (i = 0; i < count; i++){
+		size_t skip = (size_t) written < iov[i].iov_len ? (size_t) written : iov[i].iov_len;
+
+		written -= skip;
+		if (skip < iov[i].iov_len && out_queue(from, dst, (char*) iov[i].iov_base + skip, iov[i].iov_len - skip)){
+			/* Out of memory: only a message untouched by the write can still be refused */
+			return skip ? count : i;
+		}
+	}
+	out_watch(from, dst, 1);
+	return count;
+}
+
+/* Runs of messages to one peer go out with one writev() or sendmmsg(), the rest like fd_send() */
+static int fd_send_batch(PipesCommunication* from, const SendItem* items, size_t n){
+	size_t sent = 0;
+
+	while (sent < n){
+		size_t run = 0;
+
+		/* io_uring already gathers sends, and framed pipes must see one message per write */
+		if (from->uring == NULL && from->outbound != NULL && (from->seqpacket || !from->out_framed)){
+			run = out_send_run(from, items[sent].dst, items + sent, n - sent);
+		}
+		if (!run){
+			int res = fd_send(from, items[sent].dst, items[sent].message);
+
+			if (res){
+				return res == -1 && !sent ? -1 : (int) sent;
+			}
+			run = 1;
+		}
+		sent += run;
+	}
+	return sent;
+}
+
+static int fd_compare(const void* a, const void* b){
+	return *(const int*) a - *(const int*) b;
+}
+
+/** Close the fds of every other process with one close_range() per run of consecutive ones
+ *
+ * The table is opened just before fork(), so its fds mostly come in a row
+ * and this takes O(N) system calls instead of a close() for each of O(N^2)
+ * fds. Only fds of the table are closed, anything opened between them stays.
+ *
+ * @return -1 if memory is exhausted or the kernel has no close_range(), 0 on success
+ */
+static int close_foreign(PipesCommunication* comm, const int* channels){
+	size_t count = (comm->total_ids - 1) * 2;
+	size_t own = comm->current_id * count;
+	int* foreign = malloc(sizeof(int) * comm->total_ids * count);
+	size_t n = 0, i, j;
+
+	if (foreign == NULL){
+		return -1;
+	}
+	for (i = 0; i < comm->total_ids * count; i++){
+		if (channels[i] >= 0 && (i < own || i >= own + count)){
+			foreign[n++] = channels[i];
+		}
+	}
+	qsort(foreign, n, sizeof(int), fd_compare);
+	for (i = 0; i < n; i = j){
+		/* A socket sits in both slots of its peer */
+		j = i + 1;
+		while (j < n && foreign[j] <= foreign[j - 1] + 1){
+			j++;
+		}
+		if (syscall(SYS_close_range, foreign[i], foreign[j - 1], 0) < 0){
+			free(foreign);
+			return -1;
+		}
+	}
+	free(foreign);
+	return 0;
+}
+
+/** Keep the fds of comm->current_id, close the rest and register read ends in epoll
+ *
+ * Both slots of a peer hold one fd for sockets, slots of processes
+ * launched on their own are -1. SIGPIPE is ignored, so a write to a
+ * peer that exited fails with EPIPE instead of killing the process.
+ *
+ * @param channels	fd table of pipes_open(), sockets_open() or tcp_open(), freed here
+ * @param seqpacket	1 if every read and write carries exactly one message
+ *
+ * @return -1 on epoll error, 0 on success
+ */
+static int fd_attach(PipesCommunication* comm, int* channels, int seqpacket){
+	size_t proc_count = comm->total_ids;
+	size_t offset = proc_count - 1;
+	size_t i, j;
+
+	signal(SIGPIPE, SIG_IGN);
+	comm->pipes = malloc(sizeof(int) * offset * 2);
+	memcpy(comm->pipes, channels + comm->current_id * 2 * offset, sizeof(int) * offset * 2);
+	comm->seqpacket = seqpacket;
+	
+	/* Close unnecessary fds */
+	if (close_foreign(comm, channels)){
+		for (i = 0; i < proc_count; i++){
+			if (i == comm->current_id){
+				continue;
+			}
+			for (j = 0; j < proc_count; j++){
+				int* slot = channels + i * offset * 2 + (i > j ? j : j - 1) * 2;
+				
+				if (i == j || slot[PIPE_READ_TYPE] < 0){
+					continue;
+				}
+				close(slot[PIPE_READ_TYPE]);
+				if (slot[PIPE_WRITE_TYPE] != slot[PIPE_READ_TYPE]){
+					close(slot[PIPE_WRITE_TYPE]);
+				}
+			}
+		}
+	}
+	free(channels);
+	
+	/* The runtime checker expects a header read followed by a payload read
+	 * and one message per write, a datagram must carry exactly one message */
+	comm->out_framed = comm->seqpacket || getenv("PA_RT_DEBUG") != NULL;
+	if (!comm->out_framed){
+		comm->inbound = calloc(comm->total_ids, sizeof(ReadAhead));
+	}
+	comm->outbound = calloc(comm->total_ids, sizeof(OutQueue));
+	
+	comm->epoll_fd = epoll_create1(0);
+	if (comm->epoll_fd < 0){
+		return -1;
+	}
+
+	for (i = 0; i < comm->total_ids; i++){
+		struct epoll_event event;
+
+		if (i == comm->current_id){
+			continue;
+		}
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.u32 = i;
+		if (epoll_ctl(comm->epoll_fd, EPOLL_CTL_ADD, comm->pipes[GET_INDEX(i, comm->current_id) * 2 + PIPE_READ_TYPE], &event) < 0){
+			return -1;
+		}
+		comm->poll_count++;
+	}
+	return 0;
+}
+
+static int pipes_attach(PipesCommunication* comm, void* channels){
+	return fd_attach(comm, channels, 0);
+}
+
+static int sockets_attach(PipesCommunication* comm, void* channels){
+	return fd_attach(comm, channels, 1);
+}
+
+/* A stream may split and merge messages, it is framed like pipes */
+static int tcp_attach(PipesCommunication* comm, void* channels){
+	return fd_attach(comm, channels, 0);
+}
+
+/** Mark peers whose read-ahead already holds a whole message
+ *
+ * receive() of one peer may read more than it returns and empty the pipe,
+ * epoll reports nothing for those messages then.
+ *
+ * @return count of such peers
+ */
+static int read_ahead_pending(PipesCommunication* comm){
+	local_id i;
+	int ready = 0;
+
+	for (i = 0; comm->inbound != NULL && i < comm->total_ids; i++){
+		ReadAhead* in = &comm->inbound[i];
+		MessageHeader header;
+
+		if (in->end - in->start < sizeof(MessageHeader)){
+			continue;
+		}
+		memcpy(&header, in->data + in->start, sizeof(MessageHeader));
+		if (in->end - in->start >= sizeof(MessageHeader) + header.s_payload_len){
+			comm->ready[i] = 1;
+			ready++;
+		}
+	}
+	return ready;
+}
+
+/** Wait until some peer fd becomes readable and mark it ready
+ *
+ * Peers whose write end is closed are removed from epoll, write ends
+ * that got room are flushed on the way.
+ */
+static int fd_poll(PipesCommunication* comm, int timeout){
+	struct epoll_event events[MAX_PROCESS_ID + 1];
+	int count, i, ready = read_ahead_pending(comm);
+
+	/* Nothing to sleep for while a buffered message waits */
+	if (ready){
+		timeout = 0;
+	}
+	if (comm->uring != NULL){
+		if ((timeout ? uring_sleep(comm) : uring_poll(comm, 0)) < 0){
+			return -1;
+		}
+		for (i = 0, ready = 0; i < comm->total_ids; i++){
+			ready += comm->ready[i];
+		}
+		return ready;
+	}
+
+	/* The timerfd joins the epoll set once and is armed again before every sleep */
+	if (timeout && (i = wake_fd(comm)) >= 0 && !comm->timer_polled){
+		struct epoll_event event;
+
+		event.events = EPOLLIN;
+		event.data.u32 = TIMER_TAG;
+		epoll_ctl(comm->epoll_fd, EPOLL_CTL_ADD, i, &event);
+		comm->timer_polled = 1;
+	}
+	count = epoll_wait(comm->epoll_fd, events, MAX_PROCESS_ID + 1, timeout);
+	if (count < 0){
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (i = 0; i < count; i++){
+		local_id peer = events[i].data.u32;
+		
+		if (events[i].data.u32 == TIMER_TAG){
+			continue;
+		}
+		if (events[i].data.u32 >= OUT_TAG(0)){
+			out_flush(comm, events[i].data.u32 - OUT_TAG(0));
+			continue;
+		}
+
+		if (events[i].events & EPOLLIN){
+			comm->ready[peer] = 1;
+			ready++;
+		}
+		/* Data left behind a hang up stays ready until receive drains it */
+		if (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)){
+			epoll_ctl(comm->epoll_fd, EPOLL_CTL_DEL, comm->pipes[GET_INDEX(peer, comm->current_id) * 2 + PIPE_READ_TYPE], NULL);
+			comm->poll_count--;
+		}
+	}
+	return ready;
+}
+
+/** Move pipe or socket I/O of comm to io_uring
+ *
+ * A read stays posted on every peer fd and sends are batched into one
+ * submission per event loop turn, receive and receive_any reap
+ * completions without syscalls.
+ *
+ * @param comm		Pointer to PipesCommunication, pipes or sockets only
+ *
+ * @return -1 if io_uring is unavailable, 0 on success
+ */
+int uring_start(PipesCommunication* comm){
+	local_id i;
+
+	if (comm->pipes == NULL || (comm->uring = uring_init(comm->total_ids * 2)) == NULL){
+		return -1;
+	}
+	comm->channels = calloc(comm->total_ids, sizeof(UringChannel));
+	if (comm->inbound == NULL){
+		comm->inbound = calloc(comm->total_ids, sizeof(ReadAhead));
+	}
+	for (i = 0; i < comm->total_ids; i++){
+		if (i != comm->current_id){
+			uring_post_read(comm, i);
+		}
+	}
+	return uring_enter(comm->uring, 0);
+}
+
+/** Block in the kernel until the awaited peer can make progress */
+static int fd_park(PipesCommunication* comm, local_id peer, short events, size_t len){
+	struct pollfd fds[MAX_PROCESS_ID + 2];
+	local_id peers[MAX_PROCESS_ID + 2];
+	int i, count = 1;
+
+	if (comm->uring != NULL){
+		return uring_sleep(comm);
+	}
+
+	fds[0].fd = comm->pipes[GET_INDEX(peer, comm->current_id) * 2 + (events == POLLIN ? PIPE_READ_TYPE : PIPE_WRITE_TYPE)];
+	fds[0].events = events;
+	/* Keep draining queues that wait for room meanwhile */
+	for (i = 0; comm->outbound != NULL && i < comm->total_ids; i++){
+		if (comm->outbound[i].watched && !(events == POLLOUT && i == peer)){
+			fds[count].fd = comm->pipes[GET_INDEX(i, comm->current_id) * 2 + PIPE_WRITE_TYPE];
+			fds[count].events = POLLOUT;
+			peers[count++] = i;
+		}
+	}
+	/* Last, out of the way of the queues */
+	if ((fds[count].fd = wake_fd(comm)) >= 0){
+		fds[count].events = POLLIN;
+		peers[count++] = -1;
+	}
+	if (poll(fds, count, -1) < 0){
+		return errno == EINTR ? 0 : -1;
+	}
+	for (i = 1; i < count; i++){
+		if (fds[i].revents && peers[i] >= 0){
+			out_flush(comm, peers[i]);
+		}
+	}
+	/* Hang up without pending data means the peer is gone for good */
+	return !fds[0].revents || fds[0].revents & events ? 0 : -1;
+}
+
+/** Write out everything send() accepted, then close the peer fds
+ *
+ * With io_uring the writes in flight complete first.
+ */
+static void fd_close(PipesCommunication* comm){
+	local_id i;
+
+	if (comm->uring != NULL){
+		for (i = 0; i < comm->total_ids; i++){
+			while (comm->channels[i].flight_len && !uring_poll(comm, 1));
+			free(comm->channels[i].out);
+			free(comm->channels[i].flight);
+		}
+		free(comm->channels);
+		uring_destroy(comm->uring);
+	}
+	/* Draining may still watch full pipes in epoll */
+	for (i = 0; comm->outbound != NULL && i < comm->total_ids; i++){
+		size_t round = 0;
+		
+		while (out_flush(comm, i) == -2 && !wait_idle(comm, &round, i, POLLOUT, 0));
+		free(comm->outbound[i].data);
+	}
+	free(comm->outbound);
+	comm->outbound = NULL;
+	if (comm->epoll_fd >= 0){
+		close(comm->epoll_fd);
+		comm->epoll_fd = -1;
+	}
+	free(comm->inbound);
+	for (i = 0; comm->pipes != NULL && i < comm->total_ids - 1; i++){
+		close(comm->pipes[i * 2 + PIPE_READ_TYPE]);
+		if (comm->pipes[i * 2 + PIPE_WRITE_TYPE] != comm->pipes[i * 2 + PIPE_READ_TYPE]){
+			close(comm->pipes[i * 2 + PIPE_WRITE_TYPE]);
+		}
+	}
+	free(comm->pipes);
+}
+
+/* Anonymous pipes, a pair per direction, reads run ahead and sends are queued */
+const Transport pipe_transport = {
+	"pipe",
+	pipes_open,
+	NULL,
+	pipes_attach,
+	fd_send,
+	fd_receive,
+	NULL,
+	fd_send_batch,
+	fd_poll,
+	fd_park,
+	fd_flush,
+	fd_close,
+	NULL
+};
+
+/* SOCK_SEQPACKET Unix socket pairs, one datagram carries one message */
+const Transport uds_transport = {
+	"uds",
+	sockets_open,
+	NULL,
+	sockets_attach,
+	fd_send,
+	fd_receive,
+	NULL,
+	fd_send_batch,
+	fd_poll,
+	fd_park,
+	fd_flush,
+	fd_close,
+	NULL
+};
+
+/* Loopback TCP connections made before fork(), or connections between
+ * processes launched on their own that met through a peers file */
+const Transport tcp_transport = {
+	"tcp",
+	tcp_open,
+	tcp_open_node,
+	tcp_attach,
+	fd_send,
+	fd_receive,
+	NULL,
+	fd_send_batch,
+	fd_poll,
+	fd_park,
+	fd_flush,
+	fd_close,
+	NULL
+};
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include "fiber.h"
+#include "timer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+
+typedef struct{
+	ucontext_t context;
+	void* stack;
+	void (*run)(void*);
+	void* arg;
+	void* local;
+	int done;
+	int waiting;		/* it came back through fiber_wait() */
+	int64_t due;		/* monotonic_us() its fiber_wait() ends at, -1 for none */
+} Fiber;
+
+/* Run queue of one worker thread. The owner takes fibers from the front
+ * and puts yielded ones to the back, idle workers steal from the back. */
+typedef struct{
+	pthread_t thread;
+	ucontext_t context;
+	pthread_mutex_t lock;
+	Fiber** queue;
+	size_t head;
+	size_t len;
+	struct FiberPool* pool;
+} Worker;
+
+/* Workers whose fibers all wait sleep on wake until fiber_wake() bumps
+ * wake_seq, sleepers tells fiber_wake() whether to signal at all. */
+struct FiberPool{
+	Worker* workers;
+	size_t worker_count;
+	Fiber* fibers;
+	size_t fiber_count;
+	size_t spawned;
+	size_t live;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	uint32_t wake_seq;
+	uint32_t sleepers;
+};
+
+static __thread Worker* current_worker = NULL;
+static __thread Fiber* current_fiber = NULL;
+
+/** Create worker_count workers for at most fiber_count fibers
+ *
+ * @return NULL if memory is exhausted
+ */
+FiberPool* fiber_pool_init(size_t worker_count, size_t fiber_count){
+	FiberPool* pool = calloc(1, sizeof(FiberPool));
+	pthread_condattr_t attr;
+	size_t i;
+
+	if (pool == NULL){
+		return NULL;
+	}
+	/* Deadlines of fiber_wait() are monotonic_us() values */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pool->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->worker_count = worker_count;
+	pool->fiber_count = fiber_count;
+	pool->workers = calloc(worker_count, sizeof(Worker));
+	pool->fibers = calloc(fiber_count, sizeof(Fiber));
+	if (pool->workers == NULL || pool->fibers == NULL){
+		fiber_pool_destroy(pool);
+		return NULL;
+	}
+	for (i = 0; i < worker_count; i++){
+		pthread_mutex_init(&pool->workers[i].lock, NULL);
+		pool->workers[i].queue = calloc(fiber_count, sizeof(Fiber*));
+		pool->workers[i].pool = pool;
+	}
+	return pool;
+}
+
+static void queue_put(Worker* worker, Fiber* fiber){
+	size_t cap = worker->pool->fiber_count;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->queue[(worker->head + worker->len) % cap] = fiber;
+	worker->len++;
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/* Take a fiber from the front for the owner or from the back for a thief, NULL if the queue is empty */
+static Fiber* queue_take(Worker* worker, int steal){
+	size_t cap = worker->pool->fiber_count;
+	Fiber* fiber = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->len){
+		worker->len--;
+		if (steal){
+			fiber = worker->queue[(worker->head + worker->len) % cap];
+		}
+		else{
+			fiber = worker->queue[worker->head];
+			worker->head = (worker->head + 1) % cap;
+		}
+	}
+	pthread_mutex_unlock(&worker->lock);
+	return fiber;
+}
+
+/* Steal from the other workers in turn starting after self, NULL if all of them are empty */
+static Fiber* steal(Worker* self){
+	FiberPool* pool = self->pool;
+	size_t own = self - pool->workers;
+	size_t i;
+	Fiber* fiber;
+
+	for (i = 1; i < pool->worker_count; i++){
+		if ((fiber = queue_take(&pool->workers[(own + i) % pool->worker_count], 1)) != NULL){
+			return fiber;
+		}
+	}
+	return NULL;
+}
+
+static void fiber_main(void){
+	current_fiber->run(current_fiber->arg);
+	current_fiber->done = 1;
+	swapcontext(&current_fiber->context, &current_worker->context);
+}
+
+/** Sleep until fiber_wake() was called since the worker read seen from wake_seq
+ *
+ * @param due	monotonic_us() to wake up at anyway, -1 for none
+ */
+static void pool_sleep(FiberPool* pool, uint32_t seen, int64_t due){
+	struct timespec at;
+
+	at.tv_sec = due / 1000000;
+	at.tv_nsec = due % 1000000 * 1000;
+	pthread_mutex_lock(&pool->lock);
+	__atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&pool->wake_seq, __ATOMIC_SEQ_CST) == seen && __atomic_load_n(&pool->live, __ATOMIC_ACQUIRE)){
+		if (due < 0){
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		else if (pthread_cond_timedwait(&pool->wake, &pool->lock, &at) == ETIMEDOUT){
+			break;
+		}
+	}
+	__atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_wake(FiberPool* pool){
+	__atomic_add_fetch(&pool->wake_seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST)){
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->wake);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/** Create a fiber running run(arg), the workers share the fibers once started
+ *
+ * @param local		Value fiber_local() returns inside the fiber
+ *
+ * @return -1 if the pool is full or memory is exhausted, 0 on success
+ */
+int fiber_spawn(FiberPool* pool, void (*run)(void*), void* arg, void* local){
+	Fiber* fiber;
+
+	if (pool->spawned == pool->fiber_count){
+		return -1;
+	}
+	fiber = &pool->fibers[pool->spawned];
+	if ((fiber->stack = malloc(FIBER_STACK_SIZE)) == NULL || getcontext(&fiber->context) < 0){
+		return -1;
+	}
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+	fiber->context.uc_link = NULL;
+	makecontext(&fiber->context, fiber_main, 0);
+	fiber->run = run;
+	fiber->arg = arg;
+	fiber->local = local;
+	fiber->waiting = 0;
+	fiber->due = -1;
+
+	queue_put(&pool->workers[pool->spawned % pool->worker_count], fiber);
+	pool->spawned++;
+	pool->live++;
+	return 0;
+}
+
+/** Switch to runnable fibers until none is left alive, a fiber comes back here when it yields or ends
+ *
+ * A round over the whole queue in which every fiber came back through
+ * fiber_wait() and nobody called fiber_wake() means none of them can go
+ * on: the worker sleeps until fiber_wake() or the earliest deadline of
+ * the waiting fibers. A worker with nothing to run or steal sleeps too.
+ */
+static void* worker_run(void* arg){
+	Worker* self = arg;
+	FiberPool* pool = self->pool;
+	Fiber* fiber;
+	size_t round = 0;
+	uint32_t seen = __atomic_load_n(&pool->wake_seq, __ATOMIC_SEQ_CST);
+	int64_t due = -1;
+
+	current_worker = self;
+	while (__atomic_load_n(&pool->live, __ATOMIC_ACQUIRE)){
+		if ((fiber = queue_take(self, 0)) == NULL && (fiber = steal(self)) == NULL){
+			pool_sleep(pool, seen, -1);
+			seen = __atomic_load_n(&pool->wake_seq, __ATOMIC_SEQ_CST);
+			round = 0;
+			due = -1;
+			continue;
+		}
+		current_fiber = fiber;
+		fiber->waiting = 0;
+		swapcontext(&self->context, &fiber->context);
+		current_fiber = NULL;
+
+		if (fiber->done){
+			__atomic_sub_fetch(&pool->live, 1, __ATOMIC_RELEASE);
+			pool_wake(pool);
+			continue;
+		}
+		queue_put(self, fiber);
+		if (!fiber->waiting){
+			round = 0;
+			due = -1;
+			seen = __atomic_load_n(&pool->wake_seq, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		if (fiber->due >= 0 && (due < 0 || fiber->due < due)){
+			due = fiber->due;
+		}
+		if (++round >= __atomic_load_n(&self->len, __ATOMIC_RELAXED)){
+			pool_sleep(pool, seen, due);
+			seen = __atomic_load_n(&pool->wake_seq, __ATOMIC_SEQ_CST);
+			round = 0;
+			due = -1;
+		}
+	}
+	return NULL;
+}
+
+/** Run the spawned fibers on the workers until every fiber ended
+ *
+ * The calling thread is the first worker. The fibers of a worker thread
+ * that can not be started are stolen by the others.
+ */
+void fiber_pool_run(FiberPool* pool){
+	size_t i, started;
+
+	for (started = 1; started < pool->worker_count; started++){
+		if (pthread_create(&pool->workers[started].thread, NULL, worker_run, &pool->workers[started])){
+			break;
+		}
+	}
+	worker_run(&pool->workers[0]);
+	for (i = 1; i < started; i++){
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	current_worker = NULL;
+}
+
+void fiber_pool_destroy(FiberPool* pool){
+	size_t i;
+
+	if (pool->workers != NULL){
+		for (i = 0; i < pool->worker_count; i++){
+			pthread_mutex_destroy(&pool->workers[i].lock);
+			free(pool->workers[i].queue);
+		}
+	}
+	if (pool->fibers != NULL){
+		for (i = 0; i < pool->spawned; i++){
+			free(pool->fibers[i].stack);
+		}
+	}
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool->fibers);
+	free(pool);
+}
+
+/* Let the other fibers run, the caller resumes later on any worker; outside fibers yield the thread */
+void fiber_yield(void){
+	if (current_fiber == NULL){
+		sched_yield();
+		return;
+	}
+	swapcontext(&current_fiber->context, &current_worker->context);
+}
+
+/** Let the other fibers run until something the caller waits for may have happened
+ *
+ * Unlike fiber_yield(), a worker whose fibers all wait here sleeps until
+ * fiber_wake() or until timeout_us microseconds passed.
+ *
+ * @param timeout_us	Longest wait, -1 for none
+ */
+void fiber_wait(long timeout_us){
+	if (current_fiber == NULL){
+		sched_yield();
+		return;
+	}
+	current_fiber->waiting = 1;
+	current_fiber->due = timeout_us < 0 ? -1 : monotonic_us() + timeout_us;
+	swapcontext(&current_fiber->context, &current_worker->context);
+}
+
+/* Something a fiber may wait for happened, sleeping workers run their fibers again */
+void fiber_wake(void){
+	if (current_worker != NULL){
+		pool_wake(current_worker->pool);
+	}
+}
+
+/**
+ * @return local value of the running fiber, NULL outside fibers
+ */
+void* fiber_local(void){
+	return current_fiber != NULL ? current_fiber->local : NULL;
+}
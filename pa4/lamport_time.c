@@ -1,7 +1,17 @@
 #include "lamport_time.h"
+#include "fiber.h"
 #include <stdlib.h>
 
-static timestamp_t lamport_time = 0;
+/* Every participant has its own clock, also when participants are threads.
+ * It is kept wide, messages and logs carry its low bits. */
+static __thread wide_timestamp_t lamport_time = 0;
+
+/* A fiber may resume on another thread, it carries its clock as its local value */
+static wide_timestamp_t* lamport_clock(){
+	wide_timestamp_t* clock = fiber_local();
+
+	return clock != NULL ? clock : &lamport_time;
+}
 
 
 int node_cmp(QueueNode* one, QueueNode* two){
@@ -42,7 +52,7 @@ void lamport_queue_destroy(LamportQueue* queue){
 }
 
 
-void lamport_queue_insert(LamportQueue* queue, timestamp_t key, local_id value){
+void lamport_queue_insert(LamportQueue* queue, wide_timestamp_t key, local_id value){
 	QueueNode* node = malloc(sizeof(QueueNode));
 	node->key = key;
 	node->value = value;
@@ -108,22 +118,26 @@ local_id lamport_queue_get(LamportQueue* queue){
 }
 
 timestamp_t increment_lamport_time(){
-	lamport_time++;
-	return lamport_time;
+	return ++*lamport_clock();
 }
 
-timestamp_t set_lamport_time(timestamp_t new_lamport_time){
-	if (lamport_time < new_lamport_time){
-		lamport_time = new_lamport_time;
+timestamp_t set_lamport_time(wide_timestamp_t new_lamport_time){
+	wide_timestamp_t* clock = lamport_clock();
+
+	if (*clock < new_lamport_time){
+		*clock = new_lamport_time;
 	}
-	return lamport_time;
+	return *clock;
 }
 
 timestamp_t set_lamport_time_from_msg(Message* msg){
-	set_lamport_time(msg->s_header.s_local_time);
-	return lamport_time;
+	return set_lamport_time(message_time(msg));
 }
 
 timestamp_t get_lamport_time(){
-	return lamport_time;
+	return *lamport_clock();
+}
+
+wide_timestamp_t get_wide_lamport_time(){
+	return *lamport_clock();
 }
@@ -2,11 +2,12 @@
 #define __IFMO_DISTRIBUTED_CLASS_LAMPORT__H
 
 #include "ipc.h"
+#include "transport.h"
 
 struct Node{
 	struct Node* prev;	
 	struct Node* next;	
-	int key;			
+	wide_timestamp_t key;	
 	int value;			
 };
 
@@ -20,14 +21,15 @@ typedef struct{
 LamportQueue* lamport_queue_init();
 void lamport_queue_destroy(LamportQueue* queue);
 
-void lamport_queue_insert(LamportQueue* queue, timestamp_t key, local_id value);
+void lamport_queue_insert(LamportQueue* queue, wide_timestamp_t key, local_id value);
 local_id lamport_queue_peek(LamportQueue* queue);
 local_id lamport_queue_get(LamportQueue* queue);
 
 /* Time functions */
 timestamp_t increment_lamport_time();
-timestamp_t set_lamport_time(timestamp_t new_lamport_time);
+timestamp_t set_lamport_time(wide_timestamp_t new_lamport_time);
 timestamp_t set_lamport_time_from_msg(Message* msg);
 timestamp_t get_lamport_time();
+wide_timestamp_t get_wide_lamport_time();
 
 #endif
@@ -5,12 +5,16 @@
 #include "ipc.h"
 
 
-void log_init();
+void log_init(const char* mode);
 void log_started(local_id id);
 void log_received_all_started(local_id id);
 void log_done(local_id id);
 void log_received_all_done(local_id id);
 void log_pipes(PipesCommunication* pipes_comm);
+void log_wait_stats(PipesCommunication* pipes_comm);
+void log_out_stats(PipesCommunication* pipes_comm);
+void log_startup_stats(PipesCommunication* pipes_comm);
+void log_sim_stats(PipesCommunication* pipes_comm);
 void log_destroy();
 
 #endif
@@ -5,22 +5,24 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <getopt.h>
-#include <fcntl.h>
+#include <pthread.h>
 #include "log4pa.h"
 #include "communication.h"
 #include "lamport_time.h"
 #include "cs_pa4.h"
 #include "pa2345.h"
 #include "common.h"
+#include "spawn.h"
+#include "fiber.h"
 
 
 
 FILE* pipes_log_f;
 FILE* events_log_f;
 
-void log_init(){
-	pipes_log_f = fopen(pipes_log, "w");
-	events_log_f = fopen(events_log, "w");
+void log_init(const char* mode){
+	pipes_log_f = fopen(pipes_log, mode);
+	events_log_f = fopen(events_log, mode);
 }
 
 
@@ -47,7 +49,12 @@ void log_received_all_done(local_id id){
 void log_pipes(PipesCommunication* pipes_comm){
 	size_t i;
 	
-	fprintf(pipes_log_f, "Process %d pipes:\n", pipes_comm->current_id);
+	if (pipes_comm->pipes == NULL){
+		fprintf(pipes_log_f, "Process %d uses %s transport\n", pipes_comm->current_id, pipes_comm->transport->name);
+		return;
+	}
+	
+	fprintf(pipes_log_f, "Process %d %s:\n", pipes_comm->current_id, pipes_comm->seqpacket ? "sockets" : "pipes");
 	
 	for (i = 0; i < pipes_comm->total_ids; i++){
 		if (i == pipes_comm->current_id){
@@ -60,6 +67,30 @@ void log_pipes(PipesCommunication* pipes_comm){
 	fprintf(pipes_log_f, "\n");
 }
 
+void log_wait_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "Process %d waited: %zu spins, %zu yields, %zu parks\n", pipes_comm->current_id,
+		pipes_comm->wait_stats.spins, pipes_comm->wait_stats.yields, pipes_comm->wait_stats.parks);
+}
+
+void log_startup_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "Process %d received all STARTED %ld us after startup\n", pipes_comm->current_id, pipes_comm->startup_us);
+}
+
+void log_sim_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "Process %d done at tick %ld: %zu messages sent, %zu received, %.1f ticks in flight on average\n", pipes_comm->current_id,
+		sim_time(pipes_comm), pipes_comm->sim_stats.sent, pipes_comm->sim_stats.received,
+		pipes_comm->sim_stats.received ? (double) pipes_comm->sim_stats.in_flight / pipes_comm->sim_stats.received : 0.0);
+	if (pipes_comm->cs_count){
+		fprintf(stderr, "Process %d entered %zu critical areas: %.1f ticks waited and %.1f messages sent per entry\n", pipes_comm->current_id,
+			pipes_comm->cs_count, (double) pipes_comm->cs_wait_time / pipes_comm->cs_count,
+			(double) pipes_comm->sim_stats.sent / pipes_comm->cs_count);
+	}
+}
+void log_out_stats(PipesCommunication* pipes_comm){
+	fprintf(stderr, "Process %d sent: %zu writes, %zu partial, %zu full pipe, %zu throttled, %zu bytes queued at most\n", pipes_comm->current_id,
+		pipes_comm->out_stats.writes, pipes_comm->out_stats.partial, pipes_comm->out_stats.full,
+		pipes_comm->out_stats.throttled, pipes_comm->out_stats.max_queued);
+}
 void log_destroy(){
 	fclose(pipes_log_f);
     fclose(events_log_f);
@@ -69,34 +100,28 @@ int request_cs(const void * self){
 	CS* lamport_comm = (CS*) self;
 	PipesCommunication* comm = lamport_comm->comm;
 	LamportQueue* queue = lamport_comm->queue;
-	Message msg;
 	size_t reply_left = comm->total_ids - 2;
+	long requested_at = sim_time(comm);
 	
-	lamport_queue_insert(queue, get_lamport_time(), comm->current_id);
+	lamport_queue_insert(queue, get_wide_lamport_time(), comm->current_id);
 	send_all_request_msg(comm);
 	
 	
 	while (reply_left){
-		while (receive_any(comm, &msg));
-		
-		set_lamport_time_from_msg(&msg);
-		
-		cs_work(lamport_comm, &msg);
-		
-		if (msg.s_header.s_type == CS_REPLY){
-            reply_left--;
-        }
+		reply_left -= cs_receive(lamport_comm);
 	}
 	
 	
 	while (lamport_queue_peek(queue) != comm->current_id){
-		while (receive_any(comm, &msg));
-		
-		set_lamport_time_from_msg(&msg);
-		
-		cs_work(lamport_comm, &msg);
+		cs_receive(lamport_comm);
 	}
 	
+	comm->cs_count++;
+	comm->cs_wait_time += sim_time(comm) - requested_at;
+	/* Queued sends must not wait for our critical area. Replies owed under
+	 * --piggyback stay owed: every request we have not answered yet is behind
+	 * ours in the queue, so they cost nothing by riding on our RELEASE. */
+	flush(comm);
 	return 0;
 }
 
@@ -106,21 +131,52 @@ int release_cs(const void * self){
 	LamportQueue* queue = lamport_comm->queue;
 	
 	send_all_release_msg(comm);
+	flush(comm);
 	lamport_queue_get(queue);
 	return 0;
 }
 
-int cs_work(CS* lamport_comm, Message* msg){
-	PipesCommunication* comm = lamport_comm->comm;
+/** Take a burst of messages with receive_many(), merge the clock and run cs_work() on each in order
+ *
+ * Every request of the burst is answered by one send_batch() once the
+ * burst is handled.
+ *
+ * @return count of CS_REPLY messages in the burst
+ */
+size_t cs_receive(CS* lamport_comm){
+	Message messages[RECEIVE_BATCH];
+	local_id from[RECEIVE_BATCH];
+	size_t replies = 0;
+	int count, k;
+	
+	while ((count = receive_many(lamport_comm->comm, messages, RECEIVE_BATCH, from)) < 0);
+	
+	for (k = 0; k < count; k++){
+		set_lamport_time_from_msg(&messages[k]);
+		
+		cs_work(lamport_comm, &messages[k], from[k]);
+		
+		if (messages[k].s_header.s_type == CS_REPLY){
+			replies++;
+		}
+	}
+	if (lamport_comm->reply_count){
+		send_reply_msg(lamport_comm->comm, lamport_comm->reply_to, lamport_comm->reply_count);
+		lamport_comm->reply_count = 0;
+	}
+	return replies;
+}
+
+int cs_work(CS* lamport_comm, Message* msg, local_id from){
 	LamportQueue* queue = lamport_comm->queue;
 	
 	if (msg->s_header.s_type == CS_REQUEST){
-        lamport_queue_insert(queue, msg->s_header.s_local_time - 1, comm->last_msg_from);
+        lamport_queue_insert(queue, message_time(msg) - 1, from);
 
-        send_reply_msg(comm, comm->last_msg_from);
+        lamport_comm->reply_to[lamport_comm->reply_count++] = from;
     }
     else if (msg->s_header.s_type == CS_RELEASE){
-        if (lamport_queue_get(queue) != comm->last_msg_from){
+        if (lamport_queue_get(queue) != from){
             return -1;
         }
     }
@@ -130,69 +186,26 @@ int cs_work(CS* lamport_comm, Message* msg){
 	return 0;
 }
 
-int set_nonblock(int pipe_id);
-
-int* pipes_init(size_t proc_count){
-	
-
-	int* pipes = malloc(sizeof(int) * proc_count * (proc_count-1)*2);
-	size_t i, j;
-	size_t offset = proc_count - 1;
-	for (i = 0; i < proc_count; i++){
-		for (j = 0; j < proc_count; j++){
-			int tmp_fd[2];
-			
-			if (i == j){
-				continue;
-			}
-			
-			if (pipe(tmp_fd) < 0){
-				return (int*)NULL;
-			}
-			
-			if (set_nonblock(tmp_fd[0]) || set_nonblock(tmp_fd[1])){
-				return (int*)NULL;
-			}
-			pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE] = tmp_fd[0];  
-			pipes[j * offset * 2 + (j > i ? i : i - 1) * 2 + PIPE_WRITE_TYPE] = tmp_fd[1]; 
-		}
-	}
-	return pipes;
-}
-
-
-
-PipesCommunication* communication_init(int* pipes, size_t proc_count, local_id curr_proc){
+PipesCommunication* communication_init(const Transport* transport, void* channels, size_t proc_count, local_id curr_proc){
 	PipesCommunication* this = malloc(sizeof(PipesCommunication));
-	size_t i, j;
-	size_t offset = proc_count - 1;
 
-	this->pipes = malloc(sizeof(int) * offset * 2);
+	this->transport = transport;
 	this->total_ids = proc_count;
 	this->current_id = curr_proc;
-	memcpy(this->pipes, pipes + curr_proc * 2 * offset, sizeof(int) * offset * 2);
+	this->last_msg_from = curr_proc;
+	this->cs_count = 0;
+	this->cs_wait_time = 0;
 	
-	/* Close unnecessary fds */
-	for (i = 0; i < proc_count; i++){
-		if (i == curr_proc){
-			continue;
-		}
-		for (j = 0; j < proc_count; j++){
-			close(pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_READ_TYPE]);
-			close(pipes[i * offset * 2 + (i > j ? j : j - 1) * 2 + PIPE_WRITE_TYPE]);
-		}
+	if (transport_attach(this, channels) < 0){
+		return NULL;
 	}
-	free(pipes);
+	this->wide_clock = get_wide_lamport_time;
 	return this;
 }
 
 
 void communication_destroy(PipesCommunication* pipes_comm){
-	size_t i;
-	for (i = 0; i < pipes_comm->total_ids - 1; i++){
-		close(pipes_comm->pipes[i * 2 + PIPE_READ_TYPE]);
-		close(pipes_comm->pipes[i * 2 + PIPE_WRITE_TYPE]);
-	}
+	transport_detach(pipes_comm); // flushes pending sends and closes channels
 	free(pipes_comm);
 }
 
@@ -253,14 +266,21 @@ void send_all_release_msg(PipesCommunication* pipes_comm){
 	send_multicast(pipes_comm, &message);
 }
 
-void send_reply_msg(PipesCommunication* pipes_comm, local_id dst){
+/* One reply event for all of dst, sent like a multicast to just those peers or owed to them with --piggyback */
+void send_reply_msg(PipesCommunication* pipes_comm, const local_id* dst, size_t count){
 	Message message;
+	SendItem items[MAX_PROCESS_ID + 1];
+	size_t i;
 	message.s_header.s_magic = MESSAGE_MAGIC;
         message.s_header.s_type = CS_REPLY;
         message.s_header.s_local_time = increment_lamport_time();
 	message.s_header.s_payload_len = 0;
 	
-	while (send(pipes_comm, dst, &message) < 0);
+	for (i = 0; i < count; i++){
+		items[i].dst = dst[i];
+		items[i].message = &message;
+	}
+	send_folded(pipes_comm, items, count);
 }
 
 void receive_all_msgs(PipesCommunication* pipes_comm, MessageType type){
@@ -271,13 +291,14 @@ void receive_all_msgs(PipesCommunication* pipes_comm, MessageType type){
 		if (i == pipes_comm->current_id){
 			continue;
 		}
-		while (receive(pipes_comm, i, &message) < 0);
+		receive_type_blocking(pipes_comm, i, type, &message);
 		
 		set_lamport_time_from_msg(&message);
 	}
 	
 	switch (type){
         case STARTED:
+            pipes_comm->startup_us = startup_elapsed_us();
             log_received_all_started(pipes_comm->current_id);
             break;
         case DONE:
@@ -288,94 +309,238 @@ void receive_all_msgs(PipesCommunication* pipes_comm, MessageType type){
     }
 }
 
-int set_nonblock(int pipe_id){
-	int ff = fcntl(pipe_id, F_GETFL);
-    if (ff == -1){
-        return -1;
-    }
-    ff = fcntl(pipe_id, F_SETFL, ff | O_NONBLOCK);
-    if (ff == -1){
-        return -2;
-    }
-    return 0;
-}
-
-
+/* What one participant of the run needs, in its own process or thread */
+typedef struct{
+	const Transport* transport;
+	void* channels;
+	size_t proc_count;
+	local_id id;
+	int mutexl;
+	int uring;
+	int stats;
+	WaitPolicy wait;
+	size_t high_water;
+	long piggyback;		/* microseconds replies may wait for a message to ride on, -1 to send them at once */
+	wide_timestamp_t lamport_time;	/* clock of a fiber, processes and threads keep their own */
+} Participant;
 
 int do_parent_work(PipesCommunication* pipes_comm);
 int do_child_work(PipesCommunication* pipes_comm, int mutexl);
-int get_agrs(int argc, char** argv, int* processes, int* mutexl);
+int run_participant(Participant* participant);
+int run_threads(const Participant* config);
+int run_fibers(const Participant* config, size_t workers);
+int get_agrs(int argc, char** argv, int* processes, int* mutexl, const Transport** transport, int* uring, WaitPolicy* wait, size_t* high_water, long* piggyback, int* stats, int* fork_tree, int* threads, int* fibers, local_id* node_id, const char** peers);
 
 int main(int argc, char** argv){
-	size_t i;
 	int proc_count;
-	int mutexl;
-	int* pipes;
+	const char* peers;
+	local_id node_id;
+	int fork_tree;
+	int threads;
+	int fibers;
+	Participant self;
 	pid_t* children;
-	pid_t fork_id;
-	local_id current_proc_id;
-	PipesCommunication* pipes_comm;
+	size_t child_count = 0;
+	int spawned;
 	
-	if (argc < 3 || get_agrs(argc, argv, &proc_count, &mutexl) == -1){
-		fprintf(stderr, "Usage: %s -p X [--mutexl]\n", argv[0]);
+	if (argc < 3 || get_agrs(argc, argv, &proc_count, &self.mutexl, &self.transport, &self.uring, &self.wait, &self.high_water, &self.piggyback, &self.stats, &fork_tree, &threads, &fibers, &node_id, &peers) == -1){
+		fprintf(stderr, "Usage: %s -p X [--mutexl] [--transport=pipe|shm|uds|tcp|inbox] [--uring] [--spin=N] [--yield=N] [--no-park] [--high-water=N] [--piggyback=US] [--stats] [--fork-tree] [--threads | --fibers=W | --sim [--seed=N] [--latency=const:D|uniform:MIN:MAX]] [--id=K --peers=FILE]\n", argv[0]);
 		return -1;
 	}
 	
 	
-	log_init();
+	log_init(peers == NULL ? "w" : "a"); // Nodes launched on their own share log files
 	
 	
 	children = malloc(sizeof(pid_t) * proc_count);
 	
 	
-	pipes = pipes_init(proc_count + 1); // Open pipes for all processes 
+	startup_begin();
+	if (peers == NULL){
+		self.channels = self.transport->open(proc_count + 1); // Open channels for all processes 
+	}
+	else if (self.transport->join == NULL){
+		fprintf(stderr, "%s transport can not connect processes launched on their own\n", self.transport->name);
+		return -1;
+	}
+	else{
+		self.channels = self.transport->join(peers, proc_count + 1, node_id); // Meet the other nodes through the peers file
+	}
+	if (self.channels == NULL){
+		fprintf(stderr, "Can not open %s channels for %d processes\n", self.transport->name, proc_count + 1);
+		return -2;
+	}
+	self.proc_count = proc_count + 1;
 	
 	
-	for (i = 0; i < proc_count; i++){
-		fork_id = fork();
-		if (fork_id < 0){
+	if (threads){
+		if (run_threads(&self)){
 			return -2;
 		}
-		else if (!fork_id){
-			free(children);
-			break;
+	}
+	else if (fibers){
+		if (run_fibers(&self, fibers)){
+			return -2;
 		}
-		children[i] = fork_id;
 	}
-	
-
-	if (!fork_id){
-		current_proc_id = i + 1;
+	/* A node launched on its own forks nobody */
+	else if (peers != NULL){
+		self.id = node_id;
+		run_participant(&self);
+	}
+	else if ((spawned = spawn_processes(proc_count + 1, fork_tree, children, &child_count)) < 0){
+		return -2;
 	}
 	else{
-		current_proc_id = PARENT_ID;
+		self.id = spawned;
+		run_participant(&self);
 	}
 	
+	log_destroy();
 	
-	pipes_comm = communication_init(pipes, proc_count + 1, current_proc_id);
+	/* Queued messages are out now, children may wait for them before exiting */
+	reap_children(children, child_count);
+	free(children);
+	return 0;
+}
+
+
+/** Run the participant with its own communication and Lamport clock
+ *
+ * @param participant	Settings of the participant, id set
+ *
+ * @return 0 when the participant is done
+ */
+int run_participant(Participant* participant){
+	PipesCommunication* pipes_comm = communication_init(participant->transport, participant->channels, participant->proc_count, participant->id);
+	
+	pipes_comm->wait = participant->wait;
+	pipes_comm->out_high_water = participant->high_water;
+	if (participant->piggyback >= 0 && fold_start(pipes_comm, participant->piggyback) < 0){
+		fprintf(stderr, "No timer is left for --piggyback, replies go out at once\n");
+	}
+	if (participant->uring && uring_start(pipes_comm) < 0){
+		fprintf(stderr, "io_uring is not available for this transport, using plain reads and writes\n");
+	}
 	log_pipes(pipes_comm);
 	
 	
-	if (current_proc_id == PARENT_ID){
+	if (participant->id == PARENT_ID){
 		do_parent_work(pipes_comm);
 	}
 	else{
-		do_child_work(pipes_comm, mutexl);
+		do_child_work(pipes_comm, participant->mutexl);
 	}
 	
 	
-	if (current_proc_id == PARENT_ID){
-		for (i = 0; i < proc_count; i++){
-			waitpid(children[i], NULL, 0);
+	if (participant->stats){
+		log_wait_stats(pipes_comm);
+		log_out_stats(pipes_comm);
+		log_startup_stats(pipes_comm);
+		if (pipes_comm->sim != NULL){
+			log_sim_stats(pipes_comm);
 		}
 	}
 	
-
-	log_destroy();
 	communication_destroy(pipes_comm);
 	return 0;
 }
 
+/* Every participant of the run with the settings of config and its own id */
+static Participant* participants_init(const Participant* config){
+	Participant* participants = malloc(sizeof(Participant) * config->proc_count);
+	size_t i;
+	
+	for (i = 0; i < config->proc_count; i++){
+		participants[i] = *config;
+		participants[i].id = i;
+		participants[i].lamport_time = 0;
+	}
+	return participants;
+}
+
+static void* participant_thread(void* participant){
+	run_participant(participant);
+	return NULL;
+}
+
+/** Run every child as a thread of this process, the calling thread is the parent
+ *
+ * The threads share the rings opened by config->transport and the log
+ * files, each of them keeps its own Lamport clock. The rings are released
+ * once all threads are done.
+ *
+ * @param config	Settings of all participants
+ *
+ * @return -1 if a thread can not be started, 0 on success
+ */
+int run_threads(const Participant* config){
+	Participant* participants = participants_init(config);
+	pthread_t* threads = malloc(sizeof(pthread_t) * config->proc_count);
+	size_t i;
+	
+	for (i = 1; i < config->proc_count; i++){
+		if (pthread_create(&threads[i], NULL, participant_thread, &participants[i])){
+			return -1;
+		}
+	}
+	
+	run_participant(&participants[PARENT_ID]);
+	
+	for (i = 1; i < config->proc_count; i++){
+		pthread_join(threads[i], NULL);
+	}
+	config->transport->release(config->channels, config->proc_count);
+	free(threads);
+	free(participants);
+	return 0;
+}
+
+static void participant_fiber(void* participant){
+	run_participant(participant);
+}
+
+/** Run every participant as a fiber on a pool of worker threads
+ *
+ * Each worker takes fibers from its own run queue and steals from the
+ * others when it runs dry. A fiber waiting for a message or for room in
+ * a ring yields at once, the worker switches to another fiber instead of
+ * spinning and sleeps once all of its fibers wait. The fibers share the rings of config->transport and the log
+ * files, each of them carries its own Lamport clock. A single worker
+ * switches between the fibers in a fixed order, a simulated run is the
+ * same every time.
+ *
+ * @param config	Settings of all participants
+ * @param workers	Count of worker threads
+ *
+ * @return -1 if the fibers can not be created, 0 on success
+ */
+int run_fibers(const Participant* config, size_t workers){
+	Participant* participants = participants_init(config);
+	FiberPool* pool = fiber_pool_init(workers, config->proc_count);
+	size_t i;
+	
+	if (pool == NULL){
+		return -1;
+	}
+	for (i = 0; i < config->proc_count; i++){
+		/* Waiting means yielding to the other fibers, the worker sleeps only when all of them wait */
+		participants[i].wait.spin_limit = 0;
+		participants[i].wait.yield_limit = 0;
+		participants[i].wait.park = 1;
+		if (fiber_spawn(pool, participant_fiber, &participants[i], &participants[i].lamport_time)){
+			return -1;
+		}
+	}
+	
+	fiber_pool_run(pool);
+	
+	fiber_pool_destroy(pool);
+	config->transport->release(config->channels, config->proc_count);
+	free(participants);
+	return 0;
+}
+
 
 
 
@@ -384,19 +549,24 @@ int do_parent_work(PipesCommunication* pipes_comm){
 	lamport_comm.comm = pipes_comm;
 	lamport_comm.queue = NULL;
 	lamport_comm.done_left = pipes_comm->total_ids - 1;
+	lamport_comm.reply_count = 0;
 	
 	
 	receive_all_msgs(pipes_comm, STARTED);
 	
 	
 	while (lamport_comm.done_left){
-		Message message;
+		Message messages[RECEIVE_BATCH];
+		local_id from[RECEIVE_BATCH];
+		int count, k;
 		
-		while (receive_any(pipes_comm, &message));
+		while ((count = receive_many(pipes_comm, messages, RECEIVE_BATCH, from)) < 0);
 		
-		if (message.s_header.s_type == DONE){
-			set_lamport_time_from_msg(&message);
-			cs_work(&lamport_comm, &message);
+		for (k = 0; k < count; k++){
+			if (messages[k].s_header.s_type == DONE){
+				set_lamport_time_from_msg(&messages[k]);
+				cs_work(&lamport_comm, &messages[k], from[k]);
+			}
 		}
 	}
 	
@@ -412,6 +582,7 @@ int do_child_work(PipesCommunication* pipes_comm, int mutexl){
 	lamport_comm.comm = pipes_comm;
 	lamport_comm.queue = queue;
 	lamport_comm.done_left = pipes_comm->total_ids - 2;
+	lamport_comm.reply_count = 0;
 	
 	
 	send_all_proc_event_msg(pipes_comm, STARTED);
@@ -437,12 +608,7 @@ int do_child_work(PipesCommunication* pipes_comm, int mutexl){
 	send_all_proc_event_msg(pipes_comm, DONE);
 	
 	while (lamport_comm.done_left){
-		Message message;
-		
-		while (receive_any(pipes_comm, &message));
-		
-		set_lamport_time_from_msg(&message);
-		cs_work(&lamport_comm, &message);
+		cs_receive(&lamport_comm);
 	}
 	log_received_all_done(pipes_comm->current_id);
 	
@@ -451,22 +617,116 @@ int do_child_work(PipesCommunication* pipes_comm, int mutexl){
 }
 
 
-int get_agrs(int argc, char** argv, int* processes, int* mutexl){
+int get_agrs(int argc, char** argv, int* processes, int* mutexl, const Transport** transport, int* uring, WaitPolicy* wait, size_t* high_water, long* piggyback, int* stats, int* fork_tree, int* threads, int* fibers, local_id* node_id, const char** peers){
 	int res;
+	int sim = 0;
+	const char* latency = NULL;
+	unsigned long seed = 1;
 	const struct option long_options[] = {
         {"mutexl", no_argument, mutexl, 1},
+        {"transport", required_argument, NULL, 't'},
+        {"id", required_argument, NULL, 'i'},
+        {"peers", required_argument, NULL, 'P'},
+        {"uring", no_argument, uring, 1},
+        {"spin", required_argument, NULL, 's'},
+        {"yield", required_argument, NULL, 'y'},
+        {"no-park", no_argument, NULL, 'n'},
+        {"high-water", required_argument, NULL, 'w'},
+        {"piggyback", required_argument, NULL, 'b'},
+        {"stats", no_argument, stats, 1},
+        {"fork-tree", no_argument, fork_tree, 1},
+        {"threads", no_argument, threads, 1},
+        {"fibers", required_argument, NULL, 'f'},
+        {"sim", no_argument, &sim, 1},
+        {"seed", required_argument, NULL, 'S'},
+        {"latency", required_argument, NULL, 'L'},
         {NULL, 0, NULL, 0}
     };
 	
 	*mutexl = 0;
+	*transport = NULL;
+	*node_id = -1;
+	*peers = NULL;
+	*uring = 0;
+	*stats = 0;
+	*fork_tree = 0;
+	*threads = 0;
+	*fibers = 0;
+	*wait = default_wait_policy;
+	*high_water = OUT_HIGH_WATER;
+	*piggyback = -1;
 	
 	while ((res = getopt_long(argc, argv, "p:", long_options, NULL)) != -1){
 		if (res == 'p'){
 			*processes = atoi(optarg);
 		}
+		else if (res == 't'){
+			if ((*transport = transport_find(optarg)) == NULL){
+				return -1;
+			}
+		}
+		else if (res == 'i'){
+			*node_id = atoi(optarg);
+		}
+		else if (res == 'P'){
+			*peers = optarg;
+		}
+		else if (res == 's'){
+			wait->spin_limit = atoi(optarg);
+		}
+		else if (res == 'y'){
+			wait->yield_limit = atoi(optarg);
+		}
+		else if (res == 'n'){
+			wait->park = 0;
+		}
+		else if (res == 'w'){
+			*high_water = atol(optarg);
+		}
+		else if (res == 'b'){
+			if ((*piggyback = atol(optarg)) < 0){
+				return -1;
+			}
+		}
+		else if (res == 'f'){
+			if ((*fibers = atoi(optarg)) <= 0){
+				return -1;
+			}
+		}
+		else if (res == 'S'){
+			seed = strtoul(optarg, NULL, 10);
+		}
+		else if (res == 'L'){
+			latency = optarg;
+		}
 		else if (res == '?'){
 			return -1;
 		}
 	}
+	/* Threads and fibers talk through rings in the memory they share, neither apart nor over another transport */
+	if (*threads || *fibers){
+		if (*transport != NULL || *peers != NULL || (*threads && *fibers)){
+			return -1;
+		}
+		*transport = *threads ? &thread_transport : &fiber_transport;
+	}
+	/* A simulation runs every participant as a fiber of one worker, in virtual time */
+	if (sim){
+		if (*transport != NULL || *peers != NULL || sim_transport_configure(latency, seed)){
+			return -1;
+		}
+		*transport = &sim_transport;
+		*fibers = 1;
+	}
+	else if (latency != NULL){
+		return -1;
+	}
+	if (*transport == NULL){
+		*transport = *peers != NULL ? &tcp_transport : &pipe_transport;
+	}
+	/* A node launched on its own needs its id and the rendezvous file */
+	if ((*peers != NULL) != (*node_id >= 0) || *node_id > *processes){
+		return -1;
+	}
 	return 0;
 }
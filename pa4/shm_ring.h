@@ -0,0 +1,84 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_SHM_RING__H
+#define __IFMO_DISTRIBUTED_CLASS_SHM_RING__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+enum {
+	SHM_RING_SIZE = 1 << 16,	/* bytes of frame data per ring, power of two */
+	SHM_CACHE_LINE = 64,
+	SHM_MAX_PROCS = 16		/* MAX_PROCESS_ID + 1 */
+};
+
+/* Cursor head of a broadcast reader that closed its end, no frame waits for it */
+#define SHM_READER_GONE UINT64_MAX
+
+/* Prefix of every frame. seq counts all frames of the producing process,
+ * unicast and broadcast alike, so a consumer can merge both in order. */
+typedef struct{
+	uint32_t len;
+	uint32_t seq;
+} ShmFrameHeader;
+
+/* Single-producer/single-consumer ring of frames.
+ * head is only written by the consumer, tail only by the producer. */
+typedef struct{
+	uint64_t head;
+	char head_pad[SHM_CACHE_LINE - sizeof(uint64_t)];
+	uint64_t tail;
+	char tail_pad[SHM_CACHE_LINE - sizeof(uint64_t)];
+	char data[SHM_RING_SIZE];
+} ShmRing;
+
+typedef struct{
+	uint64_t head;
+	char pad[SHM_CACHE_LINE - sizeof(uint64_t)];
+} ShmCursor;
+
+/* Single-producer/multi-consumer ring, every frame is read by all
+ * consumers. Each consumer owns a cursor, the slowest one gates reuse. */
+typedef struct{
+	uint64_t tail;
+	char tail_pad[SHM_CACHE_LINE - sizeof(uint64_t)];
+	ShmCursor cursors[SHM_MAX_PROCS];
+	char data[SHM_RING_SIZE];
+} ShmBroadcast;
+
+/* Per-process futex word, bumped by peers whenever they push a frame to
+ * the process or free room in a ring it produces into while it sleeps. */
+typedef struct{
+	uint32_t seq;
+	uint32_t sleeping;
+	uint32_t closed;	/* the owner closed its end, it pushes and takes no more frames */
+	char pad[SHM_CACHE_LINE - 3 * sizeof(uint32_t)];
+} ShmDoorbell;
+
+ShmRing* shm_rings_init(size_t proc_count);
+void shm_rings_destroy(ShmRing* rings, size_t proc_count);
+ShmRing* shm_ring_get(ShmRing* rings, size_t proc_count, size_t from, size_t to);
+
+int shm_ring_push(ShmRing* ring, uint32_t seq, const void* data, uint32_t len);
+size_t shm_ring_pushv(ShmRing* ring, uint32_t seq, const struct iovec* frames, size_t n);
+int shm_ring_peek(ShmRing* ring, uint32_t* seq);
+int shm_ring_pop(ShmRing* ring, void* data, uint32_t capacity);
+int shm_ring_empty(ShmRing* ring);
+size_t shm_ring_free(ShmRing* ring);
+
+ShmBroadcast* shm_broadcast_get(ShmRing* rings, size_t proc_count, size_t from);
+int shm_broadcast_push(ShmBroadcast* ring, size_t proc_count, size_t from, uint32_t seq, const void* data, uint32_t len);
+int shm_broadcast_peek(ShmBroadcast* ring, size_t reader, uint32_t* seq);
+int shm_broadcast_pop(ShmBroadcast* ring, size_t reader, void* data, uint32_t capacity);
+int shm_broadcast_empty(ShmBroadcast* ring, size_t reader);
+size_t shm_broadcast_free(ShmBroadcast* ring, size_t proc_count, size_t from);
+void shm_broadcast_leave(ShmBroadcast* ring, size_t reader);
+
+ShmDoorbell* shm_doorbell_get(ShmRing* rings, size_t proc_count, size_t id);
+uint32_t shm_doorbell_prepare(ShmDoorbell* bell);
+void shm_doorbell_wait(ShmDoorbell* bell, uint32_t seq, long timeout_us);
+void shm_doorbell_cancel(ShmDoorbell* bell);
+void shm_doorbell_ring(ShmDoorbell* bell);
+void shm_doorbell_close(ShmDoorbell* bell);
+int shm_doorbell_closed(ShmDoorbell* bell);
+
+#endif
@@ -0,0 +1,336 @@
+#include "ipc.h"
+#include "communication.h"
+#include "transport.h"
+#include "shm_ring.h"
+#include "fiber.h"
+#include <poll.h>
+
+
+static void* rings_open(size_t proc_count){
+	return shm_rings_init(proc_count);
+}
+
+/* The mapping is inherited through fork(), every process keeps all of it */
+static int rings_attach(PipesCommunication* comm, void* channels){
+	comm->shm = channels;
+	comm->poll_count = comm->total_ids - 1;
+	return 0;
+}
+
+/* Whether a frame from the peer waits in its unicast or broadcast ring */
+static int shm_pending(PipesCommunication* this, local_id from){
+	return !shm_ring_empty(shm_ring_get(this->shm, this->total_ids, from, this->current_id))
+		|| !shm_broadcast_empty(shm_broadcast_get(this->shm, this->total_ids, from), this->current_id);
+}
+
+/* The peer closed its end and every frame it pushed to this process is taken */
+static int shm_gone(PipesCommunication* this, local_id from){
+	return shm_doorbell_closed(shm_doorbell_get(this->shm, this->total_ids, from)) && !shm_pending(this, from);
+}
+
+/* A peer that closed its end takes nothing anymore, its messages are dropped like writes to a closed pipe */
+static int shm_dropped(PipesCommunication* from, local_id dst){
+	return shm_doorbell_closed(shm_doorbell_get(from->shm, from->total_ids, dst));
+}
+
+/** Take the oldest frame from the peer, merging its unicast and broadcast rings by sequence number
+ *
+ * The sender publishes frames in sequence order, so once a frame is seen
+ * in one ring every older frame of the other ring is visible too.
+ *
+ * @return RECEIVE_CLOSED once the peer closed its end and all it sent is taken
+ */
+static int shm_receive(PipesCommunication* this, local_id from, Message* message){
+	ShmRing* ring = shm_ring_get(this->shm, this->total_ids, from, this->current_id);
+	ShmBroadcast* broadcast = shm_broadcast_get(this->shm, this->total_ids, from);
+	uint32_t seq, broadcast_seq;
+	int len = shm_ring_peek(ring, &seq);
+
+	if (shm_broadcast_peek(broadcast, this->current_id, &broadcast_seq) < 0){
+		if (len < 0){
+			return shm_gone(this, from) ? RECEIVE_CLOSED : -2;
+		}
+		len = shm_ring_pop(ring, message, sizeof(Message));
+	}
+	else{
+		if (len < 0){
+			len = shm_ring_peek(ring, &seq);
+		}
+		if (len >= 0 && (int32_t) (seq - broadcast_seq) < 0){
+			len = shm_ring_pop(ring, message, sizeof(Message));
+		}
+		else{
+			len = shm_broadcast_pop(broadcast, this->current_id, message, sizeof(Message));
+		}
+	}
+	if (len < 0){
+		return -2;
+	}
+	/* The sender may sleep waiting for room in this ring */
+	shm_doorbell_ring(shm_doorbell_get(this->shm, this->total_ids, from));
+	return 0;
+}
+
+static int shm_send(PipesCommunication* from, local_id dst, const Message* message){
+	if (shm_dropped(from, dst)){
+		return 0;
+	}
+	if (shm_ring_push(shm_ring_get(from->shm, from->total_ids, from->current_id, dst), from->shm_seq, message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+		return -2;
+	}
+	from->shm_seq++;
+	shm_doorbell_ring(shm_doorbell_get(from->shm, from->total_ids, dst));
+	return 0;
+}
+
+/* A run of messages to one peer is published with one tail store and one doorbell ring */
+static int shm_send_batch(PipesCommunication* from, const SendItem* items, size_t n){
+	struct iovec frames[SEND_BATCH];
+	size_t sent = 0;
+
+	while (sent < n){
+		local_id dst = items[sent].dst;
+		size_t run, taken;
+
+		for (run = 0; sent + run < n && run < SEND_BATCH && items[sent + run].dst == dst; run++){
+			frames[run].iov_base = (void*) items[sent + run].message;
+			frames[run].iov_len = sizeof(MessageHeader) + items[sent + run].message->s_header.s_payload_len;
+		}
+		if (shm_dropped(from, dst)){
+			sent += run;
+			continue;
+		}
+		taken = shm_ring_pushv(shm_ring_get(from->shm, from->total_ids, from->current_id, dst), from->shm_seq, frames, run);
+		from->shm_seq += taken;
+		sent += taken;
+		if (taken){
+			shm_doorbell_ring(shm_doorbell_get(from->shm, from->total_ids, dst));
+		}
+		if (taken < run){
+			break;
+		}
+	}
+	return sent;
+}
+
+/* Write the message once into the broadcast ring, every peer reads it from there */
+static int shm_multicast(PipesCommunication* from, const Message* message){
+	local_id i;
+
+	if (shm_broadcast_push(shm_broadcast_get(from->shm, from->total_ids, from->current_id), from->total_ids, from->current_id,
+			from->shm_seq, message, sizeof(MessageHeader) + message->s_header.s_payload_len)){
+		return -2;
+	}
+	from->shm_seq++;
+	for (i = 0; i < from->total_ids; i++){
+		if (i != from->current_id){
+			shm_doorbell_ring(shm_doorbell_get(from->shm, from->total_ids, i));
+		}
+	}
+	return 0;
+}
+
+/* Mark peers with frames ready, like a pipe at EOF a peer gone stops counting as a sender */
+static int shm_scan(PipesCommunication* comm){
+	local_id i;
+	int ready = 0;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (i == comm->current_id){
+			continue;
+		}
+		if (shm_pending(comm, i)){
+			comm->ready[i] = 1;
+			ready++;
+		}
+		else if (!comm->closed[i] && shm_gone(comm, i)){
+			comm->closed[i] = 1;
+			comm->poll_count--;
+		}
+	}
+	return ready;
+}
+
+/* Mark non-empty rings ready, sleep on the doorbell while all of them are empty */
+static int shm_poll(PipesCommunication* comm, int timeout){
+	ShmDoorbell* bell = shm_doorbell_get(comm->shm, comm->total_ids, comm->current_id);
+	int ready = shm_scan(comm);
+	uint32_t seq;
+
+	if (ready || !timeout || !comm->poll_count){
+		return ready;
+	}
+	seq = shm_doorbell_prepare(bell);
+	if ((ready = shm_scan(comm))){
+		shm_doorbell_cancel(bell);
+		return ready;
+	}
+	shm_doorbell_wait(bell, seq, wake_in_us(comm));
+	return shm_scan(comm);
+}
+
+/* Room in the ring to the peer, own id stands for the broadcast ring */
+static size_t shm_send_room(PipesCommunication* comm, local_id peer){
+	if (peer == comm->current_id){
+		return shm_broadcast_free(shm_broadcast_get(comm->shm, comm->total_ids, peer), comm->total_ids, peer);
+	}
+	return shm_ring_free(shm_ring_get(comm->shm, comm->total_ids, comm->current_id, peer));
+}
+
+static int shm_park(PipesCommunication* comm, local_id peer, short events, size_t len){
+	ShmDoorbell* bell = shm_doorbell_get(comm->shm, comm->total_ids, comm->current_id);
+	uint32_t seq = shm_doorbell_prepare(bell);
+
+	if (events == POLLIN ? shm_pending(comm, peer) || shm_gone(comm, peer)
+			: shm_send_room(comm, peer) >= sizeof(ShmFrameHeader) + len || (peer != comm->current_id && shm_dropped(comm, peer))){
+		shm_doorbell_cancel(bell);
+		return 0;
+	}
+	shm_doorbell_wait(bell, seq, wake_in_us(comm));
+	return 0;
+}
+
+/* A fiber waits by letting the other fibers run, the rings are scanned again when it resumes */
+static int fiber_poll(PipesCommunication* comm, int timeout){
+	int ready = shm_scan(comm);
+
+	if (ready || !timeout || !comm->poll_count){
+		return ready;
+	}
+	fiber_wait(wake_in_us(comm));
+	return shm_scan(comm);
+}
+
+static int fiber_park(PipesCommunication* comm, local_id peer, short events, size_t len){
+	fiber_wait(wake_in_us(comm));
+	return 0;
+}
+
+/* Fibers do not sleep on doorbells: what a waiting fiber may be waiting
+ * for wakes the workers instead, a frame pushed, room freed, a peer gone */
+static int fiber_send(PipesCommunication* from, local_id dst, const Message* message){
+	int res = shm_send(from, dst, message);
+
+	if (!res){
+		fiber_wake();
+	}
+	return res;
+}
+
+static int fiber_receive(PipesCommunication* this, local_id from, Message* message){
+	int res = shm_receive(this, from, message);
+
+	if (!res){
+		fiber_wake();
+	}
+	return res;
+}
+
+static int fiber_multicast(PipesCommunication* from, const Message* message){
+	int res = shm_multicast(from, message);
+
+	if (!res){
+		fiber_wake();
+	}
+	return res;
+}
+
+static int fiber_send_batch(PipesCommunication* from, const SendItem* items, size_t n){
+	int sent = shm_send_batch(from, items, n);
+
+	if (sent > 0){
+		fiber_wake();
+	}
+	return sent;
+}
+
+/** Tell the peers this process is done
+ *
+ * Its frames stop counting against their broadcast rings, and the
+ * doorbells wake whoever waits for it to see RECEIVE_CLOSED.
+ */
+static void rings_leave(PipesCommunication* comm){
+	local_id i;
+
+	for (i = 0; i < comm->total_ids; i++){
+		if (i != comm->current_id){
+			shm_broadcast_leave(shm_broadcast_get(comm->shm, comm->total_ids, i), comm->current_id);
+		}
+	}
+	shm_doorbell_close(shm_doorbell_get(comm->shm, comm->total_ids, comm->current_id));
+	for (i = 0; i < comm->total_ids; i++){
+		if (i != comm->current_id){
+			shm_doorbell_ring(shm_doorbell_get(comm->shm, comm->total_ids, i));
+		}
+	}
+}
+
+static void fibers_leave(PipesCommunication* comm){
+	rings_leave(comm);
+	fiber_wake();
+}
+
+static void rings_close(PipesCommunication* comm){
+	rings_leave(comm);
+	shm_rings_destroy(comm->shm, comm->total_ids);
+}
+
+static void rings_release(void* channels, size_t proc_count){
+	shm_rings_destroy(channels, proc_count);
+}
+
+/* Every (src, dst) pair gets a ring in memory mapped before fork(),
+ * multicast writes a broadcast ring once, sleepers wait on a futex doorbell */
+const Transport shm_transport = {
+	"shm",
+	rings_open,
+	NULL,
+	rings_attach,
+	shm_send,
+	shm_receive,
+	shm_multicast,
+	shm_send_batch,
+	shm_poll,
+	shm_park,
+	NULL,
+	rings_close,
+	NULL
+};
+
+/* The rings of shm for participants running as threads of one process:
+ * they share the mapping, the thread that opened it unmaps it after all
+ * of them are done */
+const Transport thread_transport = {
+	"thread",
+	rings_open,
+	NULL,
+	rings_attach,
+	shm_send,
+	shm_receive,
+	shm_multicast,
+	shm_send_batch,
+	shm_poll,
+	shm_park,
+	NULL,
+	rings_leave,
+	rings_release
+};
+
+/* The rings of thread_transport for participants running as fibers on a
+ * pool of threads: a fiber that waits yields to the others of its worker,
+ * a worker whose fibers all wait sleeps until a send or receive wakes it */
+const Transport fiber_transport = {
+	"fiber",
+	rings_open,
+	NULL,
+	rings_attach,
+	fiber_send,
+	fiber_receive,
+	fiber_multicast,
+	fiber_send_batch,
+	fiber_poll,
+	fiber_park,
+	NULL,
+	fibers_leave,
+	rings_release
+};
@@ -0,0 +1,14 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_TCP__H
+#define __IFMO_DISTRIBUTED_CLASS_TCP__H
+
+#include <stddef.h>
+
+enum {
+	TCP_JOIN_TIMEOUT_MS = 30000,	/* how long tcp_join() waits for the other nodes */
+	TCP_JOIN_RETRY_MS = 10
+};
+
+int* tcp_init(size_t proc_count);
+int* tcp_join(const char* peers, size_t proc_count, int id);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_TIMER__H
+#define __IFMO_DISTRIBUTED_CLASS_TIMER__H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+	MAX_TIMERS = 8	/* periodic timers one process may run at once */
+};
+
+typedef void (*TimerHandler)(void* arg);
+
+/* Work repeated every period microseconds, a free slot has no handler */
+typedef struct{
+	int64_t due;		/* monotonic_us() of the next run */
+	long period;
+	TimerHandler handler;
+	void* arg;
+} Timer;
+
+/* Timers of one participant. Blocking calls run the due ones while they
+ * wait and sleep no longer than until the next one; sleeping in poll()
+ * watches fd, a timerfd created on first use. */
+typedef struct{
+	Timer timers[MAX_TIMERS];
+	size_t count;		/* timers running */
+	int firing;		/* handlers are running, a handler that waits does not start them again */
+	int fd;
+} TimerSet;
+
+int64_t monotonic_us(void);
+
+void timers_init(TimerSet* set);
+void timers_destroy(TimerSet* set);
+
+int timer_start(TimerSet* set, long period_us, TimerHandler handler, void* arg);
+void timer_stop(TimerSet* set, int id);
+
+int64_t timers_next(const TimerSet* set);
+int timers_fire(TimerSet* set);
+int timers_arm(TimerSet* set, int64_t at);
+
+#endif
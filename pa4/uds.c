@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include "uds.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/** Connect every pair of processes with a SOCK_SEQPACKET socket pair
+ *
+ * The table has the layout of pipes_init(). A socket is bidirectional,
+ * so both read and write slots of a peer hold the same fd, one datagram
+ * carries exactly one Message. communication.h is not included because
+ * ipc.h send() clashes with the one of sys/socket.h.
+ *
+ * @param proc_count    Process count including parent process.
+ *
+ * @return fd table, NULL on socketpair error
+ */
+int* uds_init(size_t proc_count){
+	int* sockets = malloc(sizeof(int) * proc_count * (proc_count - 1) * 2);
+	size_t i, j;
+	size_t offset = proc_count - 1;
+
+	for (i = 0; i < proc_count; i++){
+		for (j = i + 1; j < proc_count; j++){
+			int tmp_fd[2];
+
+			if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, tmp_fd) < 0){
+				free(sockets);
+				return NULL;
+			}
+			sockets[i * offset * 2 + (j - 1) * 2] = sockets[i * offset * 2 + (j - 1) * 2 + 1] = tmp_fd[0];
+			sockets[j * offset * 2 + i * 2] = sockets[j * offset * 2 + i * 2 + 1] = tmp_fd[1];
+		}
+	}
+	return sockets;
+}
+
+/* Abstract address of the inbox of process id, unique per run through the pid of the process that made it */
+static socklen_t inbox_addr(struct sockaddr_un* addr, int owner, int id){
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	return offsetof(struct sockaddr_un, sun_path) + 1
+		+ snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "ifmo-%d-%d", owner, id);
+}
+
+/** Give every process one SOCK_DGRAM socket that all peers send to
+ *
+ * @param proc_count    Process count including parent process.
+ *
+ * @return proc_count inbox fds followed by the owner pid naming them, NULL on socket error
+ */
+int* uds_inbox_init(size_t proc_count){
+	int* inboxes = malloc(sizeof(int) * (proc_count + 1));
+	struct sockaddr_un addr;
+	size_t i;
+
+	inboxes[proc_count] = getpid();
+	for (i = 0; i < proc_count; i++){
+		socklen_t len = inbox_addr(&addr, inboxes[proc_count], i);
+
+		if ((inboxes[i] = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0
+				|| bind(inboxes[i], (struct sockaddr*) &addr, len) < 0){
+			free(inboxes);
+			return NULL;
+		}
+	}
+	return inboxes;
+}
+
+/** Send each frame as a datagram of its own with one sendmmsg()
+ *
+ * @return count of leading frames sent, -1 with errno set if none was
+ */
+int uds_sendv(int fd, const struct iovec* frames, size_t n){
+	struct mmsghdr datagrams[UDS_SENDV_MAX];
+	size_t i;
+	int sent;
+
+	if (n > UDS_SENDV_MAX){
+		n = UDS_SENDV_MAX;
+	}
+	memset(datagrams, 0, sizeof(struct mmsghdr) * n);
+	for (i = 0; i < n; i++){
+		datagrams[i].msg_hdr.msg_iov = (struct iovec*) &frames[i];
+		datagrams[i].msg_hdr.msg_iovlen = 1;
+	}
+	while ((sent = sendmmsg(fd, datagrams, n, MSG_DONTWAIT)) < 0 && errno == EINTR);
+	return sent;
+}
+
+/** Send one message to the inbox of dst, tagged with the sender id
+ *
+ * @return 0 on success, -1 if dst is gone, -2 if its inbox is full
+ */
+int uds_inbox_send(int fd, int owner, int dst, char from, const void* data, size_t len){
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov[2];
+
+	iov[0].iov_base = &from;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void*) data;
+	iov[1].iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = inbox_addr(&addr, owner, dst);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while (sendmsg(fd, &msg, MSG_DONTWAIT) < 0){
+		if (errno == EAGAIN){
+			return -2;
+		}
+		if (errno != EINTR){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Take one message from the own inbox
+ *
+ * @return message length with the sender id in from, -2 if the inbox is empty
+ */
+int uds_inbox_recv(int fd, char* from, void* data, size_t cap){
+	struct msghdr msg;
+	struct iovec iov[2];
+	ssize_t len;
+
+	iov[0].iov_base = from;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = data;
+	iov[1].iov_len = cap;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while ((len = recvmsg(fd, &msg, MSG_DONTWAIT)) < 0){
+		if (errno != EINTR){
+			return -2;
+		}
+	}
+	return len < 1 ? -2 : len - 1;
+}
@@ -0,0 +1,18 @@
+#ifndef __IFMO_DISTRIBUTED_CLASS_UDS__H
+#define __IFMO_DISTRIBUTED_CLASS_UDS__H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+enum {
+	UDS_SENDV_MAX = 16	/* datagrams one uds_sendv() sends at most */
+};
+
+int* uds_init(size_t proc_count);
+int uds_sendv(int fd, const struct iovec* frames, size_t n);
+
+int* uds_inbox_init(size_t proc_count);
+int uds_inbox_send(int fd, int owner, int dst, char from, const void* data, size_t len);
+int uds_inbox_recv(int fd, char* from, void* data, size_t cap);
+
+#endif